@@ -1,172 +1,218 @@
 /* 
- * clock.c - Routines for using the cycle counters on x86, 
- *           Alpha, and Sparc boxes.
+ * clock.c - Routines for using the cycle counters on x86 boxes, and
+ *           the POSIX monotonic clock anywhere else.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
+ *
+ * The counter reads one of three sources, picked at run time with
+ * set_counter_source:
+ *    COUNTER_RDTSCP  the time stamp counter, fenced so that the timed
+ *                    code can neither start early nor finish late
+ *    COUNTER_RDTSC   the time stamp counter, unfenced, as it always was
+ *    COUNTER_CLOCK   clock_gettime(CLOCK_MONOTONIC_RAW), in ns
+ * mhz returns the rate of the source, so that counts divided by it are
+ * always microseconds. The TSC rate comes from CPUID when the processor
+ * reports it, and is otherwise calibrated against CLOCK_MONOTONIC_RAW.
  */
-
+#define _GNU_SOURCE /* CLOCK_MONOTONIC_RAW */
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/times.h>
 #include "clock.h"
 
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#define CALIBRATE_NS 50000000    /* time to calibrate the TSC against, in ns */
+
+static counter_src source = COUNTER_CLOCK; /* set by set_counter_source */
+static uint64_t start_count = 0;           /* set by start_counter */
+static double tsc_rate = 0;                /* TSC MHz, once it is known */
+
+static char *source_names[] = {"rdtscp", "rdtsc", "clock"};
+
+static uint64_t read_clock(void);
+#if HAVE_TSC
+static double tsc_mhz(int verbose);
+#endif
+
 
 /******************************************************* 
  * Machine dependent functions 
  *
- * Note: the constants __i386__ and  __alpha
+ * Note: the constants __i386__ and __x86_64__
  * are set by GCC when it calls the C preprocessor
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__) || defined(__x86_64__)
+#if HAVE_TSC
 /*******************************************************
- * Pentium versions of start_counter() and get_counter()
+ * Pentium versions of the counter reads
  *******************************************************/
 
-
 /* $begin x86cyclecounter */
-/* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
-
-
 /* Set *hi and *lo to the high and low order bits  of the cycle counter.  
    Implementation requires assembly code to use the rdtsc instruction. */
 void access_counter(unsigned *hi, unsigned *lo)
 {
-    asm("rdtsc; movl %%edx,%0; movl %%eax,%1"   /* Read cycle counter */
-        : "=r" (*hi), "=r" (*lo)                /* and move results to */
-        : /* No input */                        /* the two outputs */
-        : "%edx", "%eax");
+    asm volatile("rdtsc; movl %%edx,%0; movl %%eax,%1" /* Read cycle counter */
+                 : "=r" (*hi), "=r" (*lo)              /* and move results to */
+                 : /* No input */                      /* the two outputs */
+                 : "%edx", "%eax");
 }
+/* $end x86cyclecounter */
 
-/* Record the current value of the cycle counter. */
-void start_counter()
+/* Read the TSC once every earlier instruction has completed, so that
+   none of them is counted as part of what follows */
+static inline uint64_t tsc_begin(void)
 {
-    access_counter(&cyc_hi, &cyc_lo);
+    unsigned hi, lo;
+
+    asm volatile("mfence; lfence; rdtsc" : "=d" (hi), "=a" (lo) :: "memory");
+    return ((uint64_t)hi << 32) | lo;
 }
 
-/* Return the number of cycles since the last call to start_counter. */
-double get_counter()
+/* Read the TSC once the timed code has completed, and before any later
+   instruction starts */
+static inline uint64_t tsc_end(void)
 {
-    unsigned ncyc_hi, ncyc_lo;
-    unsigned hi, lo, borrow;
-    double result;
+    unsigned hi, lo;
 
-    /* Get cycle counter */
-    access_counter(&ncyc_hi, &ncyc_lo);
-
-    /* Do double precision subtraction */
-    lo = ncyc_lo - cyc_lo;
-    borrow = lo > ncyc_lo;
-    hi = ncyc_hi - cyc_hi - borrow;
-    result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0) {
-        fprintf(stderr, "Error: counter returns neg value: %.0f\n", result);
-    }
-    return result;
+    asm volatile("rdtscp; lfence" : "=d" (hi), "=a" (lo) :: "%ecx", "memory");
+    return ((uint64_t)hi << 32) | lo;
 }
-/* $end x86cyclecounter */
 
-#elif defined(__alpha)
+/* Read the TSC the old way, through access_counter */
+static inline uint64_t tsc_plain(void)
+{
+    unsigned hi, lo;
 
-/****************************************************
- * Alpha versions of start_counter() and get_counter()
- ***************************************************/
+    access_counter(&hi, &lo);
+    return ((uint64_t)hi << 32) | lo;
+}
+#endif /* HAVE_TSC */
 
-/* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
+/* Read the monotonic clock, in ns */
+static uint64_t read_clock(void)
+{
+    struct timespec ts;
 
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-/* Use Alpha cycle timer to compute cycles.  Then use
-   measured clock speed to compute seconds 
-*/
+/*******************************
+ * Machine-independent functions
+ ******************************/
 
 /*
- * counterRoutine is an array of Alpha instructions to access 
- * the Alpha's processor cycle counter. It uses the rpcc 
- * instruction to access the counter. This 64 bit register is 
- * divided into two parts. The lower 32 bits are the cycles 
- * used by the current process. The upper 32 bits are wall 
- * clock cycles. These instructions read the counter, and 
- * convert the lower 32 bits into an unsigned int - this is the 
- * user space counter value.
- * NOTE: The counter has a very limited time span. With a 
- * 450MhZ clock the counter can time things for about 9 
- * seconds. */
-static unsigned int counterRoutine[] =
-    {
-        0x601fc000u,
-        0x401f0000u,
-        0x6bfa8001u
-    };
-
-/* Cast the above instructions into a function. */
-static unsigned int (*counter)(void)= (void *)counterRoutine;
+ * set_counter_source - Read the given source from now on. Return -1,
+ *     and keep the old one, if this machine does not have it.
+ */
+int set_counter_source(counter_src src)
+{
+#if HAVE_TSC
+    unsigned eax, ebx, ecx, edx;
 
+    if (src == COUNTER_RDTSCP &&
+        (!__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) ||
+         !(edx & (1 << 27))))
+        return -1;
+#else
+    if (src != COUNTER_CLOCK)
+        return -1;
+#endif
+    source = src;
+    return 0;
+}
 
-void start_counter()
+counter_src get_counter_source(void)
 {
-    /* Get cycle counter */
-    cyc_hi = 0;
-    cyc_lo = counter();
+    return source;
 }
 
-double get_counter()
+/*
+ * best_counter_source - Return the source to use by default: the fenced
+ *     TSC when it ticks at a constant rate whatever the core's clock
+ *     and power state (an invariant TSC), and the monotonic clock if not
+ */
+counter_src best_counter_source(void)
 {
-    unsigned ncyc_hi, ncyc_lo;
-    unsigned hi, lo, borrow;
-    double result;
-    ncyc_lo = counter();
-    ncyc_hi = 0;
-    lo = ncyc_lo - cyc_lo;
-    borrow = lo > ncyc_lo;
-    hi = ncyc_hi - cyc_hi - borrow;
-    result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0) {
-        fprintf(stderr, "Error: Cycle counter returning negative value: %.0f\n", result);
-    }
-    return result;
+#if HAVE_TSC
+    unsigned eax, ebx, ecx, edx;
+
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1 << 8)) &&
+        __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) && (edx & (1 << 27)))
+        return COUNTER_RDTSCP;
+#endif
+    return COUNTER_CLOCK;
 }
 
-#else
+char *counter_source_name(counter_src src)
+{
+    return source_names[src];
+}
 
-/****************************************************************
- * All the other platforms for which we haven't implemented cycle
- * counter routines. Newer models of sparcs (v8plus) have cycle
- * counters that can be accessed from user programs, but since there
- * are still many sparc boxes out there that don't support this, we
- * haven't provided a Sparc version here.
- ***************************************************************/
+/*
+ * counter_source_of - Return the source with the given name, or -1
+ */
+int counter_source_of(const char *name)
+{
+    int i;
+
+    for (i = 0; i < 3; i++)
+        if (strcmp(name, source_names[i]) == 0)
+            return i;
+    return -1;
+}
 
+/* Record the current value of the counter. */
 void start_counter()
 {
-    printf("ERROR: You are trying to use a start_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    switch (source) {
+#if HAVE_TSC
+    case COUNTER_RDTSCP:
+        start_count = tsc_begin();
+        return;
+    case COUNTER_RDTSC:
+        start_count = tsc_plain();
+        return;
+#endif
+    default:
+        start_count = read_clock();
+    }
 }
 
-double get_counter() 
+/* Return the number of ticks since the last call to start_counter. */
+double get_counter()
 {
-    printf("ERROR: You are trying to use a get_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
-}
+    uint64_t now;
+
+    switch (source) {
+#if HAVE_TSC
+    case COUNTER_RDTSCP:
+        now = tsc_end();
+        break;
+    case COUNTER_RDTSC:
+        now = tsc_plain();
+        break;
 #endif
+    default:
+        now = read_clock();
+    }
+    /* Unsigned, so a counter that wraps still gives the right difference */
+    return (double)(now - start_count);
+}
 
-
-
-
-/*******************************
- * Machine-independent functions
- ******************************/
 double ovhd()
 {
     /* Do it twice to eliminate cache effects */
@@ -181,35 +227,23 @@ double ovhd()
 }
 
 /* $begin mhz */
-/* Get the clock rate from /proc */
+/*
+ * mhz_full - Return the rate of the counter in ticks per microsecond.
+ *     That is 1000 for the clock, and the TSC rate for the TSC sources:
+ *     the rate the TSC runs at, whatever the clock rate of the core
+ *     (which is what /proc/cpuinfo reports).
+ */
 double mhz_full(int verbose, int sleeptime __attribute__((unused)))
 {
-    static char buf[2048];
-
-    FILE *fp = fopen("/proc/cpuinfo", "r");
-    double mhz = 0.0;
+    double rate = 1000;
 
-    while (fgets(buf, 2048, fp)) {
-        if (strstr(buf, "cpu MHz")) {
-            sscanf(buf, "cpu MHz\t: %lf", &mhz);
-            break;
-        }
-    }
-    fclose(fp);
-    if (verbose) 
-        printf("Processor clock rate ~= %.1f MHz\n", mhz);
-    return mhz;
-
-#if 0
-    double rate;
-
-    start_counter();
-    sleep(sleeptime);
-    rate = get_counter() / (1e6*sleeptime);
+#if HAVE_TSC
+    if (source != COUNTER_CLOCK)
+        rate = tsc_mhz(verbose);
+#endif
     if (verbose) 
-        printf("Processor clock rate ~= %.1f MHz\n", rate);
+        printf("Counter (%s) rate ~= %.1f MHz\n", source_names[source], rate);
     return rate;
-#endif
 }
 /* $end mhz */
 
@@ -219,6 +253,47 @@ double mhz(int verbose)
     return mhz_full(verbose, 2);
 }
 
+#if HAVE_TSC
+/*
+ * tsc_mhz - Return the TSC rate. Leaf 0x15 of CPUID gives it as a ratio
+ *     to the crystal clock, with the crystal's rate on newer processors.
+ *     Failing that, count TSC ticks over CALIBRATE_NS of the monotonic
+ *     clock, reading the clock on both sides of each TSC read to bound
+ *     the error.
+ */
+static double tsc_mhz(int verbose)
+{
+    unsigned den, num, crystal, edx;
+    uint64_t t0, t1, t2, t3, c0, c1;
+
+    if (tsc_rate > 0)
+        return tsc_rate;
+
+    if (__get_cpuid_max(0, NULL) >= 0x15 &&
+        __get_cpuid(0x15, &den, &num, &crystal, &edx) &&
+        den != 0 && num != 0 && crystal != 0) {
+        tsc_rate = (double)crystal * num / den / 1e6;
+        if (verbose)
+            printf("TSC rate from CPUID\n");
+        return tsc_rate;
+    }
+
+    t0 = read_clock();
+    c0 = tsc_begin();
+    t1 = read_clock();
+    do {
+        t2 = read_clock();
+    } while (t2 - t0 < CALIBRATE_NS);
+    c1 = tsc_end();
+    t3 = read_clock();
+    tsc_rate = (c1 - c0) * 1e3 / ((t2 + t3) / 2.0 - (t0 + t1) / 2.0);
+    if (verbose)
+        printf("TSC rate calibrated over %.0f ms, to within %.0f ns\n",
+               (t3 - t0) / 1e6, (double)(t1 - t0 + t3 - t2) / 2);
+    return tsc_rate;
+}
+#endif /* HAVE_TSC */
+
 /** Special counters that compensate for timer interrupt overhead */
 
 static double cyc_per_tick = 0.0;
@@ -288,6 +363,10 @@ double get_comp_counter()
     times(&t);
     ticks = t.tms_utime - start_tick;
     ctime = time - ticks*cyc_per_tick;
+    /* A tick that cost more than the whole run means cyc_per_tick is off;
+       do not let it make the time negative */
+    if (ctime <= 0)
+        ctime = time;
     /*
       printf("Measured %.0f cycles.  Ticks = %d.  Corrected %.0f cycles\n",
       time, (int) ticks, ctime);
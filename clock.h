@@ -1,18 +1,34 @@
 /* Routines for using cycle counter */
 
+/* Sources the counter can read, chosen at run time */
+typedef enum {COUNTER_RDTSCP, COUNTER_RDTSC, COUNTER_CLOCK} counter_src;
+
+/* Read src from now on; returns -1 if this machine does not have it */
+int set_counter_source(counter_src src);
+
+/* The source being read */
+counter_src get_counter_source(void);
+
+/* The source to use by default: rdtscp if the TSC is invariant, else clock */
+counter_src best_counter_source(void);
+
+/* The name of a source, and the source with a name (-1 if none) */
+char *counter_source_name(counter_src src);
+int counter_source_of(const char *name);
+
 /* Start the counter */
 void start_counter();
 
-/* Get # cycles since counter started */
+/* Get # ticks since counter started */
 double get_counter();
 
 /* Measure overhead for counter */
 double ovhd();
 
-/* Determine clock rate of processor (using a default sleeptime) */
+/* Determine the rate of the counter in MHz (ticks per microsecond) */
 double mhz(int verbose);
 
-/* Determine clock rate of processor, having more control over accuracy */
+/* Same as mhz; sleeptime is no longer used */
 double mhz_full(int verbose, int sleeptime);
 
 /** Special counters that compensate for timer interrupt overhead */
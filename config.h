@@ -107,14 +107,27 @@
 #define ALIGNMENT 8
 
 /*
- * Maximum heap size in bytes
+ * Maximum heap size in bytes. Override with e.g. make MAX_HEAP=34359738368
+ * (a plain number, it is also tested by the preprocessor). Above 4 GiB,
+ * mm.c must be built with WIDE_HEADERS, see the Makefile.
  */
+#ifndef MAX_HEAP
 #define MAX_HEAP (100*(1<<20))  /* 100 MB */
+#endif
+
+/*
+ * Number of arenas memlib hands out, each an independent heap of up to
+ * MAX_HEAP bytes. The single-heap calls (mem_sbrk and friends) work on
+ * arena 0. Override with e.g. make ARENAS=8.
+ */
+#ifndef MEM_ARENAS
+#define MEM_ARENAS 4
+#endif
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
-#define USE_FCYC   1   /* cycle counter w/K-best scheme (x86 & Alpha only) */
+#define USE_FCYC   1   /* counter w/K-best scheme; mdriver -c picks the counter */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
 #define USE_GETTOD 0   /* gettimeofday (any Unix box) */
 
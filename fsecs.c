@@ -2,6 +2,14 @@
  * High-level timing wrappers
  ****************************/
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
@@ -21,7 +29,8 @@ void init_fsecs(void)
 
 #if USE_FCYC
     if (verbose)
-	printf("Measuring performance with a cycle counter.\n");
+	printf("Measuring performance with the %s counter.\n",
+	       counter_source_name(get_counter_source()));
 
     /* set key parameters for the fcyc package */
     set_fcyc_maxsamples(20); 
@@ -55,3 +64,119 @@ double fsecs(fsecs_test_funct f, void *argp)
 }
 
 
+
+/*******************************************
+ * Hardware event counters (Linux perf events)
+ *******************************************/
+#define PERF_RUNS 3     /* runs of f, keeping the least count of each event */
+
+#ifdef __linux__
+#define CACHE_MISS(cache) (PERF_COUNT_HW_CACHE_ ## cache | \
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static struct {
+    unsigned int type;
+    unsigned long long config;
+    char *name;
+} perf_events[PERF_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(L1D), "L1d-misses"},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(LL), "LLC-misses"},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(DTLB), "dTLB-misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"},
+};
+#endif
+
+static int perf_fd[PERF_EVENTS];
+static int perf_errno = 0;      /* why the last event failed to open */
+
+/*
+ * init_perf - Open a counter for each event this process may count. Each
+ *     has its own counter rather than joining a group, so that a machine
+ *     (or a container) lacking some events still counts the others.
+ */
+int init_perf(void)
+{
+    int i, opened = 0;
+#ifdef __linux__
+    struct perf_event_attr attr;
+#endif
+
+    for (i = 0; i < PERF_EVENTS; i++) {
+	perf_fd[i] = -1;
+#ifdef __linux__
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = perf_events[i].type;
+	attr.config = perf_events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;   /* allowed even when perf_event_paranoid is 2 */
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	perf_fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (perf_fd[i] < 0)
+	    perf_errno = errno;
+	else
+	    opened++;
+#else
+	perf_errno = ENOSYS;
+#endif
+    }
+    return opened;
+}
+
+char *perf_event_name(int event)
+{
+#ifdef __linux__
+    return perf_events[event].name;
+#else
+    (void)event;
+    return "unavailable";
+#endif
+}
+
+char *perf_error(void)
+{
+    return strerror(perf_errno);
+}
+
+/*
+ * fsecs_perf - Count the events over PERF_RUNS runs of f(argp), and
+ *     return the least count of each. When the events outnumber the
+ *     hardware counters the kernel takes turns among them, so each
+ *     count is scaled up by the share of the run it was counted for.
+ */
+void fsecs_perf(fsecs_test_funct f, void *argp, double *counts)
+{
+    int i, run;
+    unsigned long long value[3];    /* count, time enabled, time running */
+    double count;
+
+    for (i = 0; i < PERF_EVENTS; i++)
+	counts[i] = -1;
+
+    for (run = 0; run < PERF_RUNS; run++) {
+	for (i = 0; i < PERF_EVENTS; i++) {
+	    if (perf_fd[i] >= 0) {
+		ioctl(perf_fd[i], PERF_EVENT_IOC_RESET, 0);
+		ioctl(perf_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+	    }
+	}
+	f(argp);
+	for (i = 0; i < PERF_EVENTS; i++)
+	    if (perf_fd[i] >= 0)
+		ioctl(perf_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+	for (i = 0; i < PERF_EVENTS; i++) {
+	    if (perf_fd[i] < 0 ||
+		read(perf_fd[i], value, sizeof(value)) != sizeof(value))
+		continue;
+	    count = (value[2] == 0) ? 0 :
+		(double)value[0] * value[1] / value[2];
+	    if (counts[i] < 0 || count < counts[i])
+		counts[i] = count;
+	}
+    }
+}
@@ -2,3 +2,17 @@ typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+
+/* Hardware events counted by fsecs_perf, through Linux perf events */
+#define PERF_EVENTS 6   /* cycles, instructions, L1d, LLC, dTLB, branch misses */
+
+/* Open the event counters; returns how many this machine lets us use */
+int init_perf(void);
+
+/* Name of an event, and why none could be opened (after init_perf) */
+char *perf_event_name(int event);
+char *perf_error(void);
+
+/* Count the events over f(argp), keeping the least of a few runs of each;
+   counts[i] is -1 for an event that could not be opened */
+void fsecs_perf(fsecs_test_funct f, void *argp, double *counts);
@@ -0,0 +1,442 @@
+/*
+ * gentrace - Generate a synthetic trace from size and lifetime
+ *     distributions, for workloads the captured traces in traces/ do
+ *     not cover, and heaps far larger than theirs.
+ *
+ *     unix> ./gentrace -n 1000000 -L 50000000 -s pow:16:65536:1.1 \
+ *               -l exp:50000 -r 0.02:x1.5 -b -B traces/pow.rep
+ *
+ * writes traces/pow.rep, its balanced variant traces/pow-bal.rep (the
+ * same requests, then a free of every block still live), and with -B
+ * the binary form of both (see trace.h).
+ *
+ * Each request frees the block whose lifetime is up, if there is one;
+ * otherwise it reallocs a live block (with the -r probability), or
+ * allocates a new block, unless the live bytes are at the -L target, in
+ * which case the block due to die soonest dies now. Lifetimes count
+ * requests. Block ids are reused once freed, so num_ids is the most
+ * blocks ever live at once.
+ *
+ * Distributions, for sizes (-s) and lifetimes (-l):
+ *   fixed:<n>              always n
+ *   uni:<min>:<max>        uniform over [min, max]
+ *   exp:<mean>             exponential (sizes rounded) with this mean
+ *   pow:<min>:<max>:<a>    bounded power law, density ~ x^-(a+1)
+ *   bi:<x>:<y>:<p>         x with probability p, else y
+ *   hist:<file>            empirical: lines of "<value> <weight>"
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "trace.h"
+
+#define MAXLINE   1024          /* max string size */
+#define MAX_SIZE  ((1 << 30) - 1) /* largest request a trace can hold */
+
+/* A distribution of sizes or lifetimes */
+typedef enum {FIXED, UNIFORM, EXPONENTIAL, POWER, BIMODAL, HISTOGRAM} dist_kind;
+
+typedef struct {
+    dist_kind kind;
+    double a, b, c;          /* parameters, in the order of the spec */
+    int n;                   /* HISTOGRAM: number of values... */
+    double *value;           /* ...their values... */
+    double *cum;             /* ...and cumulative weights */
+} dist_t;
+
+/* A live block, in the min-heap of live blocks by the request they die at */
+typedef struct {
+    long death;
+    int id;
+} live_t;
+
+/* Generator state */
+static traceop_t *ops = NULL;    /* requests so far */
+static long num_ops = 0, max_ops = 0;
+static live_t *heap = NULL;      /* live blocks, soonest death first */
+static int heap_len = 0;
+static size_t *sizes = NULL;     /* size of each live id */
+static int *free_ids = NULL;     /* ids ready for reuse */
+static int num_free = 0;
+static int num_ids = 0;          /* ids handed out so far */
+static int max_ids = 0;          /* room in sizes, free_ids and heap */
+static uint64_t rng;             /* xorshift64* state */
+
+static void usage(void);
+static void parse_dist(dist_t *d, char *spec);
+static double sample(dist_t *d);
+static double uniform(void);
+static void emit(traceop_type type, int id, size_t size);
+static int new_id(void);
+static void heap_push(long death, int id);
+static int heap_pop(void);
+static void heap_swap(int i, int j);
+static void write_trace(char *path, long n, int balanced, int bin, int weight);
+static void error(char *msg);
+
+int main(int argc, char **argv)
+{
+    dist_t size_dist, life_dist;
+    char *out, *p;
+    char balpath[MAXLINE];
+    int c, id, bal = 0, bin = 0, weight = 1;
+    long i, n = 100000, live_target = 0, live = 0, now;
+    double realloc_p = 0, growth = 1.5, grow_add = 0, s;
+    uint64_t seed = 1;
+    size_t size, len;
+
+    parse_dist(&size_dist, "pow:8:4096:1");
+    parse_dist(&life_dist, "exp:1000");
+    while ((c = getopt(argc, argv, "n:L:s:l:r:S:w:bBh")) != EOF) {
+        switch (c) {
+        case 'n': /* Requests, before balancing */
+            n = atol(optarg);
+            break;
+        case 'L': /* Live bytes to stay under */
+            live_target = atol(optarg);
+            break;
+        case 's':
+            parse_dist(&size_dist, optarg);
+            break;
+        case 'l':
+            parse_dist(&life_dist, optarg);
+            break;
+        case 'r': /* <probability>:x<factor> or <probability>:+<bytes> */
+            realloc_p = strtod(optarg, &p);
+            if (*p == ':' && p[1] == 'x')
+                growth = strtod(p + 2, &p);
+            else if (*p == ':' && p[1] == '+') {
+                growth = 1;
+                grow_add = strtod(p + 2, &p);
+            }
+            if (*p != '\0' || realloc_p < 0 || realloc_p > 1 || growth <= 0)
+                usage();
+            break;
+        case 'S':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'w':
+            weight = atoi(optarg);
+            break;
+        case 'b': /* Also write the -bal variant */
+            bal = 1;
+            break;
+        case 'B': /* Also write binary traces */
+            bin = 1;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc - 1 || n <= 0)
+        usage();
+    out = argv[optind];
+    len = strlen(out);
+    if (len < 4 || len >= MAXLINE - 4 || strcmp(out + len - 4, ".rep") != 0)
+        error("the output file must be named <name>.rep");
+
+    /* splitmix64 of the seed, so that small seeds still start well mixed */
+    rng = seed + 0x9e3779b97f4a7c15ULL;
+    rng = (rng ^ (rng >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    rng = (rng ^ (rng >> 27)) * 0x94d049bb133111ebULL;
+    rng ^= rng >> 31;
+    rng = rng ? rng : 1;
+
+    for (now = 0; now < n; now++) {
+        if (heap_len > 0 && heap[0].death <= now) {
+            id = heap_pop();
+            live -= sizes[id];
+            emit(FREE, id, 0);
+        }
+        else if (heap_len > 0 && uniform() < realloc_p) {
+            id = heap[(long)(uniform() * heap_len)].id;
+            s = sizes[id] * growth + grow_add;
+            size = (s < 1) ? 1 : (s > MAX_SIZE) ? MAX_SIZE : (size_t)s;
+            live += (long)size - (long)sizes[id];
+            sizes[id] = size;
+            emit(REALLOC, id, size);
+        }
+        else {
+            s = sample(&size_dist);
+            size = (s < 1) ? 1 : (s > MAX_SIZE) ? MAX_SIZE : (size_t)s;
+            if (live_target > 0 && heap_len > 0 &&
+                live + (long)size > live_target) {
+                id = heap_pop();
+                live -= sizes[id];
+                emit(FREE, id, 0);
+                continue;
+            }
+            id = new_id();
+            sizes[id] = size;
+            live += size;
+            s = sample(&life_dist);
+            heap_push(now + 1 + (long)(s < 0 ? 0 : s), id);
+            emit(ALLOC, id, size);
+        }
+    }
+
+    /* The -bal variant frees what is left, soonest death first */
+    i = num_ops;
+    while (bal && heap_len > 0)
+        emit(FREE, heap_pop(), 0);
+
+    write_trace(out, i, 0, bin, weight);
+    if (bal) {
+        snprintf(balpath, MAXLINE, "%.*s-bal.rep", (int)(len - 4), out);
+        write_trace(balpath, num_ops, 1, bin, weight);
+    }
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: gentrace [-bB] [-n <requests>] [-L <live bytes>] "
+            "[-s <dist>] [-l <dist>]\n"
+            "                [-r <p>:x<factor>|<p>:+<bytes>] [-S <seed>] "
+            "[-w <weight>] <name>.rep\n"
+            "Options\n"
+            "\t-n <n>     Generate n requests (default 100000).\n"
+            "\t-L <bytes> Keep at most this many bytes live (default no limit).\n"
+            "\t-s <dist>  Distribution of request sizes (default pow:8:4096:1).\n"
+            "\t-l <dist>  Distribution of lifetimes, in requests (default exp:1000).\n"
+            "\t-r <spec>  Realloc a live block with probability p, growing it\n"
+            "\t           by a factor or a number of bytes (default none).\n"
+            "\t-S <seed>  Seed the generator (default 1).\n"
+            "\t-w <n>     Weight of the trace in the score (default 1).\n"
+            "\t-b         Also write <name>-bal.rep, freeing every block.\n"
+            "\t-B         Also write binary traces, <name>.bin and so on.\n"
+            "Distributions: fixed:<n> uni:<min>:<max> exp:<mean> "
+            "pow:<min>:<max>:<a>\n"
+            "               bi:<x>:<y>:<p> hist:<file>\n");
+    exit(1);
+}
+
+/*
+ * parse_dist - Read a distribution from its spec, exiting on a bad one
+ */
+static void parse_dist(dist_t *d, char *spec)
+{
+    FILE *fp;
+    char line[MAXLINE];
+    double v, w, total = 0;
+    int max = 0;
+
+    memset(d, 0, sizeof(*d));
+    if (sscanf(spec, "fixed:%lf", &d->a) == 1)
+        d->kind = FIXED;
+    else if (sscanf(spec, "uni:%lf:%lf", &d->a, &d->b) == 2 && d->a <= d->b)
+        d->kind = UNIFORM;
+    else if (sscanf(spec, "exp:%lf", &d->a) == 1 && d->a > 0)
+        d->kind = EXPONENTIAL;
+    else if (sscanf(spec, "pow:%lf:%lf:%lf", &d->a, &d->b, &d->c) == 3 &&
+             d->a > 0 && d->a < d->b && d->c > 0)
+        d->kind = POWER;
+    else if (sscanf(spec, "bi:%lf:%lf:%lf", &d->a, &d->b, &d->c) == 3 &&
+             d->c >= 0 && d->c <= 1)
+        d->kind = BIMODAL;
+    else if (strncmp(spec, "hist:", 5) == 0) {
+        d->kind = HISTOGRAM;
+        if ((fp = fopen(spec + 5, "r")) == NULL)
+            error("cannot open the histogram file");
+        while (fgets(line, MAXLINE, fp) != NULL) {
+            if (sscanf(line, "%lf %lf", &v, &w) != 2 || w <= 0)
+                continue; /* blank line or comment */
+            if (d->n == max) {
+                max = max ? 2 * max : 64;
+                d->value = realloc(d->value, max * sizeof(double));
+                d->cum = realloc(d->cum, max * sizeof(double));
+                if (d->value == NULL || d->cum == NULL)
+                    error("out of memory");
+            }
+            total += w;
+            d->value[d->n] = v;
+            d->cum[d->n++] = total;
+        }
+        fclose(fp);
+        if (d->n == 0)
+            error("the histogram file has no \"<value> <weight>\" lines");
+    }
+    else {
+        fprintf(stderr, "gentrace: bad distribution %s\n", spec);
+        usage();
+    }
+}
+
+/*
+ * sample - Draw a value from a distribution
+ */
+static double sample(dist_t *d)
+{
+    double u = uniform(), lo, hi;
+    int l, r, m;
+
+    switch (d->kind) {
+    case FIXED:
+        return d->a;
+    case UNIFORM:
+        return d->a + u * (d->b - d->a + 1);
+    case EXPONENTIAL:
+        return -d->a * log(1 - u);
+    case POWER: /* invert the CDF of the bounded Pareto */
+        lo = pow(d->a, -d->c);
+        hi = pow(d->b, -d->c);
+        return pow(lo - u * (lo - hi), -1 / d->c);
+    case BIMODAL:
+        return (u < d->c) ? d->a : d->b;
+    case HISTOGRAM: /* first value whose cumulative weight passes u */
+        u *= d->cum[d->n - 1];
+        for (l = 0, r = d->n - 1; l < r; ) {
+            m = (l + r) / 2;
+            if (d->cum[m] <= u)
+                l = m + 1;
+            else
+                r = m;
+        }
+        return d->value[l];
+    }
+    return 0;
+}
+
+/*
+ * uniform - Return a uniform double in [0, 1), from xorshift64*
+ */
+static double uniform(void)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return ((rng * 0x2545f4914f6cdd1dULL) >> 11) * (1.0 / (1ULL << 53));
+}
+
+/*
+ * emit - Append a request, and make a freed id ready for reuse
+ */
+static void emit(traceop_type type, int id, size_t size)
+{
+    if (num_ops == max_ops) {
+        max_ops = max_ops ? 2 * max_ops : 4096;
+        if ((ops = realloc(ops, max_ops * sizeof(traceop_t))) == NULL)
+            error("out of memory");
+    }
+    ops[num_ops].type = type;
+    ops[num_ops].size = size;
+    ops[num_ops].index = id;
+    num_ops++;
+    if (type == FREE)
+        free_ids[num_free++] = id;
+}
+
+/*
+ * new_id - Return a free block id, reusing freed ones first
+ */
+static int new_id(void)
+{
+    if (num_free > 0)
+        return free_ids[--num_free];
+    if (num_ids == max_ids) {
+        max_ids = max_ids ? 2 * max_ids : 1024;
+        sizes = realloc(sizes, max_ids * sizeof(size_t));
+        free_ids = realloc(free_ids, max_ids * sizeof(int));
+        heap = realloc(heap, max_ids * sizeof(live_t));
+        if (sizes == NULL || free_ids == NULL || heap == NULL)
+            error("out of memory");
+    }
+    return num_ids++;
+}
+
+/*
+ * heap_push, heap_pop - Add a live block to the heap, and take out the
+ *     one that dies soonest, returning its id
+ */
+static void heap_push(long death, int id)
+{
+    int i = heap_len++;
+
+    heap[i].death = death;
+    heap[i].id = id;
+    while (i > 0 && heap[(i - 1) / 2].death > heap[i].death) {
+        heap_swap(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static int heap_pop(void)
+{
+    int id = heap[0].id, i = 0, child;
+
+    heap_swap(0, --heap_len);
+    while ((child = 2 * i + 1) < heap_len) {
+        if (child + 1 < heap_len && heap[child + 1].death < heap[child].death)
+            child++;
+        if (heap[i].death <= heap[child].death)
+            break;
+        heap_swap(i, child);
+        i = child;
+    }
+    return id;
+}
+
+static void heap_swap(int i, int j)
+{
+    live_t t = heap[i];
+
+    heap[i] = heap[j];
+    heap[j] = t;
+}
+
+/*
+ * write_trace - Write the first n requests to path, and with bin to the
+ *     .bin beside it too
+ */
+static void write_trace(char *path, long n, int balanced, int bin, int weight)
+{
+    FILE *fp;
+    tracebin_t hdr;
+    traceop_t probe = TRACEBIN_PROBE;
+    char binpath[MAXLINE];
+    long i;
+    static const char type[] = {'a', 'f', 'r'};
+
+    if ((fp = fopen(path, "w")) == NULL)
+        error("cannot open the output file");
+    fprintf(fp, "%d\n%d\n%ld\n%d\n", weight, num_ids, n, 1);
+    for (i = 0; i < n; i++) {
+        if (ops[i].type == FREE)
+            fprintf(fp, "f %d\n", ops[i].index);
+        else
+            fprintf(fp, "%c %d %u\n", type[ops[i].type], ops[i].index,
+                    (unsigned)ops[i].size);
+    }
+    if (fclose(fp) != 0)
+        error("cannot write the output file");
+    printf("%s: %ld requests, %d ids%s\n", path, n, num_ids,
+           balanced ? ", every block freed" : "");
+
+    if (!bin)
+        return;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = TRACEBIN_MAGIC;
+    hdr.version = TRACEBIN_VERSION;
+    hdr.weight = weight;
+    hdr.num_ids = num_ids;
+    hdr.num_ops = n;
+    hdr.flag = 1;
+    hdr.probe = probe;
+    snprintf(binpath, MAXLINE, "%.*s.bin", (int)strlen(path) - 4, path);
+    if ((fp = fopen(binpath, "w")) == NULL ||
+        fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite(ops, sizeof(traceop_t), n, fp) != (size_t)n ||
+        fclose(fp) != 0)
+        error("cannot write the binary trace");
+}
+
+static void error(char *msg)
+{
+    fprintf(stderr, "gentrace: %s\n", msg);
+    exit(1);
+}
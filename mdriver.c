@@ -1,884 +1,2150 @@
-
 /*
- * mm.c
- * hbovik - Harry Bovik
- * Author:    Ming Fang
- * Mail  :    mingf@andrew.cmu.edu
- * Update:    07/13/2014
+ * mdriver.c - Malloc lab trace-replay driver
+ *
+ * Replays a collection of allocation traces against the mm_malloc,
+ * mm_free and mm_realloc routines that are linked into the binary.
+ * Each trace is checked for correctness, then its space utilization
+ * and throughput are measured.
+ *
+ * The driver does not know which allocator it is testing; the Makefile
+ * links it against each variant (mm.c, mm_nofooter.c, mm_explicit.c,
+ * mm-naive.c and mm_offset.c) to build one binary per variant.
+ *
+ * Trace file format (see traces/):
+ *   <weight>       weight of the trace in the aggregate score
+ *   <num_ids>      number of distinct block ids
+ *   <num_ops>      number of requests that follow
+ *   <flag>         trailing header flag (recorded, not interpreted)
+ *   a <id> <size>  malloc(size), remembered as block <id>
+ *   r <id> <size>  realloc(block <id>, size)
+ *   f <id>         free(block <id>); an id of -1 frees NULL
+ *
+ * With -T <n>, each correct trace is also replayed by 1 to n threads at
+ * once, sharing one allocator, to measure how its throughput scales.
+ * Only a thread-safe allocator (mm.c) can be replayed this way.
+ *
+ * With -H, each correct trace is also replayed once with every request
+ * timed on the cycle counter, and the driver prints the p50, p99, p99.9
+ * and max latency of each request type. -C <file> writes the underlying
+ * histograms, by request type and size class, to <file> as CSV.
  *
- * This version is implemented using segregated list
- * LIFO order to maintain each free list.
- * 
+ * With -P, the driver also counts hardware events (cycles, instructions,
+ * cache, TLB and branch misses) over a replay of each correct trace, and
+ * prints them per request. It goes on without them where the kernel or
+ * the container does not allow perf events.
+ *
+ * -F <policy> picks the fit policy of an allocator that has several
+ * (mm.c), and the -v table then shows the free blocks each search for
+ * a fit visited, on average. -O <order> picks the order free blocks
+ * are kept in, for one that has several (mm.c): lifo, fifo or addr.
+ * An allocator that counts its merges and splits (mm.c) has them
+ * printed after the summary, with its deferred frees, if any.
+ *
+ * -R replays each correct trace again up to its peak payload and, for an
+ * allocator that can account for its heap (mm.c), reports where the
+ * heap's bytes are at that point: payload, tags and padding (internal
+ * fragmentation), and free blocks by size and by seg list (external).
  */
-
-#include <assert.h>
-#include <stdio.h>
+#include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <string.h>
-#include <unistd.h>
-#include "contracts.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 #include "mm.h"
 #include "memlib.h"
-
-
-// Create aliases for driver tests
-// DO NOT CHANGE THE FOLLOWING!
-#ifdef DRIVER
-#define malloc mm_malloc
-#define free mm_free
-#define realloc mm_realloc
-#define calloc mm_calloc
-#endif
+#include "fsecs.h"
+#include "clock.h"
+#include "config.h"
+#include "sizeclass.h"
+#include "trace.h"
+
+/**********************
+ * Constants and macros
+ **********************/
+
+/* Misc */
+#define MAXLINE     1024 /* max string size */
+#define HDRLINES    4    /* number of header lines in a trace file */
+#define LINENUM(i)  (i+HDRLINES+1) /* cnvt trace request nums to linenums */
+#define CHECK_FULL  6    /* mm_checkheap level of mm.c's full check, -D */
+
+/* Returns true if p is ALIGNMENT-byte aligned */
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
+
+/* Latency histograms: log-linear, so each bucket is within ~3% of its
+ * samples at any scale, as in HdrHistogram */
+#define HIST_SUB_BITS 5    /* buckets per power of two, as a log */
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((65 - HIST_SUB_BITS) * HIST_SUB)
+#define LAT_TYPES     3    /* one histogram per request type... */
+#define LAT_CLASSES   5    /* ...and request size class */
+
+/* Threaded replay */
+#define THREAD_RUNS   3    /* runs per thread count, the fastest is kept */
+#define HANDOFF_SIZE  1024 /* blocks in flight from one thread to the next */
+
+/******************************
+ * The key compound data types
+ *****************************/
+
+/* Holds the information for one trace file */
+typedef struct {
+    int weight;          /* weight of this trace in the aggregate score */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of distinct requests */
+    int flag;            /* trailing header flag */
+    traceop_t *ops;      /* array of requests */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* the binary trace ops points into, or NULL */
+    size_t map_size;
+} trace_t;
 
 /*
- *  Logging Functions
- *  -----------------
- *  - dbg_printf acts like printf, but will not be run in a release build.
- *  - checkheap acts like mm_checkheap, but prints the line it failed on and
- *    exits if it fails.
+ * Holds the params to the xxx_speed functions, which are timed by fcyc.
+ * This struct is necessary because fcyc accepts only a pointer array
+ * as input.
  */
+typedef struct {
+    trace_t *trace;
+} speed_t;
 
-#ifndef NDEBUG
-#define dbg_printf(...) printf(__VA_ARGS__)
-#define checkheap(verbose) do {if (mm_checkheap(verbose)) {  \
-                             printf("Checkheap failed on line %d\n", __LINE__);\
-                             exit(-1);  \
-                        }}while(0)
-#else
-#define dbg_printf(...)
-#define checkheap(...)
-#endif
-
-/* Basic constants */
-#define WSIZE         4      /* Word and header/footer size (bytes) */
-#define DSIZE         8      /* Double word size (bytes) */
-#define CHUNKSIZE     128    /* Extend heap by this (1K words, 4K bytes) */
-#define FREE          0      /* Mark block as free */
-#define ALLOCATED     1      /* Mark block as allocated */
-#define SEG_LIST_SIZE 14     /* The seg list has 14 entries */
-#define VERBOSE       0      /* Indicator to print debug info */
-
-/* Private global variable */
-static uint32_t *heap_listp;
-static uint32_t **seg_list;
+/*
+ * How a threaded replay shares a trace among its threads:
+ *   SPLIT  each thread replays the requests of its own range of ids
+ *   COPY   each thread replays the whole trace, with its own blocks
+ *   CROSS  like SPLIT, but each block is freed by the next thread
+ */
+typedef enum {SPLIT, COPY, CROSS} replay_t;
 
-/*    Segregated List 
- * Size(DWORD)    Entry
- * 1                0
- * 2                1
- * 3-4              2
- * 5-8              3
- * 9-16             4
- * 17-32            5
- * 33-64            6
- * 65-128           7
- * 129-256          8
- * 257-512          9
- * 513-1024         10
- * 1025-2048        11
- * 2049-4096        12
- * 4097-Inf         13
+/*
+ * Single-producer single-consumer ring carrying the blocks a thread
+ * frees in CROSS mode to the next thread, which frees them
  */
+typedef struct {
+    char *slot[HANDOFF_SIZE];
+    volatile unsigned int head;  /* next slot to take, moved by the consumer */
+    volatile unsigned int tail;  /* next slot to fill, moved by the producer */
+} handoff_t;
+
+/* One thread of a threaded replay */
+typedef struct {
+    pthread_t tid;
+    traceop_t *ops;              /* this thread's share of the requests */
+    int num_ops;
+    char **blocks;               /* its own array of block ptrs, by id */
+    handoff_t *inbox;            /* blocks to free for the previous thread */
+    handoff_t *outbox;           /* blocks for the next thread to free */
+    pthread_barrier_t *start;    /* released once every thread is ready */
+    double begin, end;           /* when it started and finished its requests */
+} worker_t;
+
+/* Latencies of one kind of request, in counter ticks */
+typedef struct {
+    unsigned long count[HIST_BUCKETS];
+    unsigned long total;         /* number of samples */
+    double max;                  /* largest sample */
+} hist_t;
+
+/* Summarizes the important stats for some malloc function on some trace */
+typedef struct {
+    /* defined for both libc malloc and student malloc package (mm.c) */
+    double ops;      /* number of ops (malloc/free/realloc) in the trace */
+    int valid;       /* was the trace processed correctly by the allocator? */
+    double secs;     /* number of secs needed to run the trace */
+
+    /* defined only for the student malloc package */
+    double util;     /* space utilization for this trace (always 0 for libc) */
+    double nodes;    /* free blocks visited per fit search, or -1 if the
+                        package does not report it */
+} stats_t;
+
+/********************
+ * Global variables
+ *******************/
+int verbose = 0;        /* global flag for verbose output */
+static int errors = 0;  /* number of errs found when running student malloc */
+static int checkheap = 0; /* run mm_checkheap after every request */
+static int nthreads = 0;  /* replay with up to this many threads (-T) */
+static replay_t replay = SPLIT; /* how threads share a trace (-m) */
+static char *replay_names[] = {"split", "copy", "cross"};
+static int histograms = 0; /* time every request (-H) */
+static FILE *hist_csv = NULL; /* and export the histograms here (-C) */
+static int counter = -1;  /* the counter source to time with (-c) */
+static char msg[2*MAXLINE]; /* for whenever we need to compose an error message */
+
+/* Names of the traces being run, for error messages */
+static char **tracenames = NULL;
+
+/* Directory where default tracefiles are found */
+static char tracedir[MAXLINE] = TRACEDIR;
+
+/* The filenames of the default tracefiles */
+static char *default_tracefiles[] = {
+    DEFAULT_TRACEFILES, NULL
+};
 
+/*
+ * Shadow map of the payload words currently handed out by the
+ * allocator, one bit per ALIGNMENT bytes of every arena of the
+ * simulated heap. Used to detect overlapping payloads in constant time
+ * per word instead of walking a list of live ranges. shadow_top[i] is
+ * one past the last byte of arena i's part of the map set since the
+ * last clear_ranges, so that only those bytes need clearing.
+ */
+#define SHADOW_ARENA ((size_t)MAX_HEAP / ALIGNMENT / 8)
+static unsigned char *shadow = NULL;
+static size_t shadow_top[MEM_ARENAS];
 
 /*
- *  Helper functions
- *  ----------------
+ * Allocator-specific flags and counters. Only some variants define
+ * these, so they are weak and checked for NULL before use.
  */
+#pragma weak mm_thread_safe
+#pragma weak mm_tcache_stats
+#pragma weak mm_realloc_stats
+#pragma weak mm_remote_stats
+#pragma weak mm_trim
+#pragma weak mm_fit_policy
+#pragma weak mm_fit_stats
+#pragma weak mm_free_order
+#pragma weak mm_coalesce_stats
+#pragma weak mm_frag_stats
+
+/*********************
+ * Function prototypes
+ *********************/
+
+/* These functions manipulate the shadow map of live payloads */
+static int add_range(char *lo, size_t size, int tracenum, int opnum);
+static void remove_range(char *lo, size_t size);
+
+/* These functions read, allocate, and free storage for traces */
+static trace_t *read_trace(char *tracedir, char *filename);
+static int map_trace(trace_t *trace, char *path);
+static int find_bin(char *path, char *binpath);
+static void free_trace(trace_t *trace);
+
+/* Routines for evaluating the correctness and speed of libc malloc */
+static int eval_libc_valid(trace_t *trace, int tracenum);
+static void eval_libc_speed(void *ptr);
+
+/* Routines for evaluating correctness, space utilization, and speed
+   of the student's malloc package in mm.c */
+static int eval_mm_valid(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum);
+static void eval_mm_frag(trace_t *trace, int tracenum);
+static void eval_mm_speed(void *ptr);
+
+/* Routines for replaying a trace with several threads at once */
+static void eval_mm_threads(trace_t *trace, int tracenum,
+                            double *thread_secs, double *thread_ops);
+static double run_threads(trace_t *trace, int n, double *lat);
+static void *replay_thread(void *arg);
+static int put_handoff(handoff_t *h, char *p);
+static void drain_handoff(handoff_t *h);
+static double wall_secs(void);
+
+/* Routines for timing each request of a trace */
+static void init_latency(char *csvname);
+static void eval_mm_latency(trace_t *trace, int tracenum);
+static void print_latency(hist_t *h, int n, char *label);
+static void hist_add(hist_t *h, double cycles);
+static double hist_percentile(hist_t *h, int n, double q);
+static unsigned long hist_lo(int bucket);
+static unsigned long hist_hi(int bucket);
+
+/* Various helper routines */
+static char *trace_name(int tracenum);
+static void printresults(int n, char **names, stats_t *stats);
+static void printperf(int n, char **names, stats_t *stats,
+                      double (*counts)[PERF_EVENTS]);
+static void usage(void);
+static void unix_error(char *msg);
+static void malloc_error(char *name, int opnum, char *msg);
+static void app_error(char *msg);
+
+/**************
+ * Main routine
+ **************/
+int main(int argc, char **argv)
+{
+    int i;
+    int c;
+    char **tracefiles = NULL;  /* null-terminated array of trace file names */
+    int num_tracefiles = 0;    /* the number of traces in that array */
+    trace_t *trace = NULL;     /* stores a single trace file in memory */
+    stats_t *libc_stats = NULL;/* libc stats for each trace */
+    stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    speed_t speed_params;      /* input parameters to the xx_speed routines */
+
+    int run_libc = 0;    /* If set, run libc malloc (set by -l) */
+    int run_perf = 0;    /* If set, count hardware events (set by -P) */
+    int run_frag = 0;    /* If set, report fragmentation (set by -R) */
+    double (*perf_counts)[PERF_EVENTS] = NULL; /* events for each trace */
+
+    double secs, ops, avg_mm_util, avg_mm_throughput, weight;
+    double p1, p2, perfindex;
+    int numcorrect;
+    double *thread_secs = NULL; /* summed over the traces, by thread count */
+    double *thread_ops = NULL;
+    double kops, kops_1;
+    char *csvname = NULL;      /* histogram CSV file (set by -C) */
+    char *fit = NULL;          /* fit policy (set by -F) */
+    struct mm_fit_stats fit_before, fit_after;
+    double fit_searches = 0, fit_nodes = 0;
+    double fit_inserts = 0, fit_steps = 0;
+    char *order = NULL;        /* free list order (set by -O) */
+    struct mm_coalesce_stats coal_before, coal_after;
+    double merges = 0, splits = 0, deferred = 0, reused = 0, sweeps = 0;
+
+    /*
+     * Read and interpret the command line arguments
+     */
+    while ((c = getopt(argc, argv, "f:t:hvVlDT:m:HC:c:PF:O:R")) != EOF) {
+        switch (c) {
+        case 'f': /* Use one specific trace file only (relative to curr dir) */
+            num_tracefiles = 1;
+            if ((tracefiles = realloc(tracefiles, 2*sizeof(char *))) == NULL)
+                unix_error("ERROR: realloc failed in main");
+            tracedir[0] = '\0';
+            tracefiles[0] = strdup(optarg);
+            tracefiles[1] = NULL;
+            break;
+        case 't': /* Directory where the traces are located */
+            if (num_tracefiles == 1) /* ignore if -f already encountered */
+                break;
+            strncpy(tracedir, optarg, MAXLINE - 2);
+            tracedir[MAXLINE - 2] = '\0';
+            if (tracedir[strlen(tracedir)-1] != '/')
+                strcat(tracedir, "/"); /* path always ends with "/" */
+            break;
+        case 'l': /* Run libc malloc */
+            run_libc = 1;
+            break;
+        case 'P': /* Count hardware events */
+            run_perf = 1;
+            break;
+        case 'R': /* Report fragmentation at peak payload */
+            run_frag = 1;
+            break;
+        case 'F': /* Fit policy */
+            fit = optarg;
+            break;
+        case 'O': /* Free list order */
+            order = optarg;
+            break;
+        case 'v': /* Print per-trace performance breakdown */
+            verbose = 1;
+            break;
+        case 'V': /* Be more verbose than -v */
+            verbose = 2;
+            break;
+        case 'D': /* Check the heap after every request */
+            checkheap = 1;
+            break;
+        case 'T': /* Also replay with 1 to n threads */
+            nthreads = atoi(optarg);
+            if (nthreads < 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'm': /* How the threads share a trace */
+            for (i = 0; i < 3 && strcmp(optarg, replay_names[i]) != 0; i++)
+                ;
+            if (i == 3) {
+                usage();
+                exit(1);
+            }
+            replay = (replay_t)i;
+            break;
+        case 'c': /* Counter to time with */
+            if ((counter = counter_source_of(optarg)) < 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'H': /* Time every request */
+            histograms = 1;
+            break;
+        case 'C': /* Export the latency histograms */
+            histograms = 1;
+            csvname = optarg;
+            break;
+        case 'h': /* Print this message */
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
 
-// Align p to a multiple of w bytes
-static inline void* align(const void const* p, unsigned char w) {
-    return (void*)(((uintptr_t)(p) + (w-1)) & ~(w-1));
-}
+    /*
+     * If no -f command line arg, then use the entire set of tracefiles
+     * defined in default_traces[]
+     */
+    if (tracefiles == NULL) {
+        tracefiles = default_tracefiles;
+        num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
+        printf("Using default tracefiles in %s\n", tracedir);
+    }
 
-// Check if the given pointer is 8-byte aligned
-static inline int aligned(const void const* p) {
-    return align(p, 8) == p;
-}
+    tracenames = tracefiles;
 
-// Return whether the pointer is in the heap.
-static int in_heap(const void* p) {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
-}
+    if (fit != NULL && mm_fit_policy == NULL) {
+        fprintf(stderr, "This malloc package has only one fit policy\n");
+        exit(1);
+    }
+    if (fit != NULL && mm_fit_policy(fit) < 0) {
+        usage();
+        exit(1);
+    }
+    if (order != NULL && mm_free_order == NULL) {
+        fprintf(stderr, "This malloc package has only one free list order\n");
+        exit(1);
+    }
+    if (order != NULL && mm_free_order(order) < 0) {
+        usage();
+        exit(1);
+    }
+    if (nthreads > 1 && &mm_thread_safe == NULL) {
+        fprintf(stderr, "This malloc package is not thread-safe, "
+                "-T must be 1\n");
+        exit(1);
+    }
+    if (run_frag && mm_frag_stats == NULL) {
+        printf("This malloc package cannot account for its heap, ignoring -R\n");
+        run_frag = 0;
+    }
 
+    /* Initialize the timing package */
+    if (counter < 0)
+        counter = best_counter_source();
+    if (set_counter_source((counter_src)counter) < 0) {
+        fprintf(stderr, "This machine has no %s counter\n",
+                counter_source_name((counter_src)counter));
+        exit(1);
+    }
+    init_fsecs();
+    if (run_perf && init_perf() == 0) {
+        printf("No hardware event counters (%s), ignoring -P\n", perf_error());
+        run_perf = 0;
+    }
+    if (run_perf &&
+        (perf_counts = calloc(num_tracefiles, sizeof(*perf_counts))) == NULL)
+        unix_error("perf_counts calloc in main failed");
+    if (histograms)
+        init_latency(csvname);
+
+    /*
+     * Optionally run and evaluate the libc malloc package
+     */
+    if (run_libc) {
+        if (verbose > 1)
+            printf("\nTesting libc malloc\n");
+
+        /* Allocate libc stats array, with one stats_t struct per tracefile */
+        libc_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+        if (libc_stats == NULL)
+            unix_error("libc_stats calloc in main failed");
+
+        /* Evaluate the libc malloc package using the K-best scheme */
+        for (i=0; i < num_tracefiles; i++) {
+            trace = read_trace(tracedir, tracefiles[i]);
+            libc_stats[i].ops = trace->num_ops;
+            if (verbose > 1)
+                printf("Checking libc malloc for correctness, ");
+            libc_stats[i].nodes = -1;
+            libc_stats[i].valid = eval_libc_valid(trace, i);
+            if (libc_stats[i].valid) {
+                speed_params.trace = trace;
+                if (verbose > 1)
+                    printf("and performance.\n");
+                libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+            }
+            free_trace(trace);
+        }
 
+        /* Display the libc results in a compact table */
+        if (verbose) {
+            printf("\nResults for libc malloc:\n");
+            printresults(num_tracefiles, tracefiles, libc_stats);
+        }
+    }
 
-/*
- *  Block Functions
- *  ---------------
- *  TODO: Add your comment describing block functions here.
- *  The functions below act similar to the macros in the book, but calculate
- *  size in multiples of 4 bytes.
- */
+    /*
+     * Always run and evaluate the student's mm package
+     */
+    if (verbose > 1)
+        printf("\nTesting mm malloc\n");
+
+    /* Allocate the mm stats array, with one stats_t struct per tracefile */
+    mm_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+    if (mm_stats == NULL)
+        unix_error("mm_stats calloc in main failed");
+
+    /* Initialize the simulated memory system in memlib.c */
+    mem_init();
+
+    /* The shadow map covers every arena of the simulated heap */
+    shadow = calloc(MEM_ARENAS * SHADOW_ARENA + 1, 1);
+    if (shadow == NULL)
+        unix_error("shadow calloc in main failed");
+
+    thread_secs = calloc(nthreads + 1, sizeof(double));
+    thread_ops = calloc(nthreads + 1, sizeof(double));
+    if (thread_secs == NULL || thread_ops == NULL)
+        unix_error("thread stats calloc in main failed");
+
+    /* Evaluate student's mm malloc package using the K-best scheme */
+    weight = 0;
+    avg_mm_util = 0;
+    secs = 0;
+    ops = 0;
+    numcorrect = 0;
+    for (i=0; i < num_tracefiles; i++) {
+        trace = read_trace(tracedir, tracefiles[i]);
+        mm_stats[i].ops = trace->num_ops;
+        mm_stats[i].nodes = -1;
+        if (verbose > 1)
+            printf("Checking mm_malloc for correctness, ");
+        mm_stats[i].valid = eval_mm_valid(trace, i);
+        if (mm_stats[i].valid) {
+            if (verbose > 1)
+                printf("efficiency, ");
+            if (mm_fit_stats)
+                mm_fit_stats(&fit_before);
+            if (mm_coalesce_stats)
+                mm_coalesce_stats(&coal_before);
+            mm_stats[i].util = eval_mm_util(trace, i);
+            if (mm_fit_stats) {
+                mm_fit_stats(&fit_after);
+                fit_searches += fit_after.searches - fit_before.searches;
+                fit_nodes += fit_after.nodes - fit_before.nodes;
+                fit_inserts += fit_after.inserts - fit_before.inserts;
+                fit_steps += fit_after.steps - fit_before.steps;
+                mm_stats[i].nodes = (fit_after.searches == fit_before.searches) ?
+                    0 : (double)(fit_after.nodes - fit_before.nodes) /
+                    (fit_after.searches - fit_before.searches);
+            }
+            if (mm_coalesce_stats) {
+                mm_coalesce_stats(&coal_after);
+                merges += coal_after.merges - coal_before.merges;
+                splits += coal_after.splits - coal_before.splits;
+                deferred += coal_after.deferred - coal_before.deferred;
+                reused += coal_after.reused - coal_before.reused;
+                sweeps += coal_after.sweeps - coal_before.sweeps;
+            }
+            speed_params.trace = trace;
+            if (verbose > 1)
+                printf("and performance.\n");
+            mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+            numcorrect++;
+            if (nthreads > 0)
+                eval_mm_threads(trace, i, thread_secs, thread_ops);
+            if (histograms)
+                eval_mm_latency(trace, i);
+            if (run_perf)
+                fsecs_perf(eval_mm_speed, &speed_params, perf_counts[i]);
+            if (run_frag)
+                eval_mm_frag(trace, i);
+
+            /* Traces of weight 0 are checked but do not count in the score */
+            weight += trace->weight;
+            avg_mm_util += trace->weight * mm_stats[i].util;
+            secs += trace->weight * mm_stats[i].secs;
+            ops += trace->weight * mm_stats[i].ops;
+        }
+        free_trace(trace);
+    }
 
-// Return the size of the given block in multiples of the word size
-// This size doesn't count header and footer
-static inline unsigned int block_size(const uint32_t* block) {
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
+    /* Display the mm results in a compact table */
+    if (verbose) {
+        printf("\nResults for mm malloc:\n");
+        printresults(num_tracefiles, tracefiles, mm_stats);
+        printf("\n");
+    }
+    if (run_perf) {
+        printf("Hardware events per request for mm malloc:\n");
+        printperf(num_tracefiles, tracefiles, mm_stats, perf_counts);
+        printf("\n");
+    }
 
-    return (block[0] & 0x3FFFFFFF);
-}
+    /* Sum up the threaded replays over all traces, scoring the
+     * throughput at each thread count against MIN_SPEED and MAX_SPEED */
+    if (nthreads > 0 && numcorrect == num_tracefiles) {
+        printf("\nThreaded %s replay, all traces:\n", replay_names[replay]);
+        kops_1 = thread_ops[1] / 1e3 / thread_secs[1];
+        for (i = 1; i <= nthreads; i++) {
+            kops = thread_ops[i] / 1e3 / thread_secs[i];
+            p2 = (kops * 1e3 - MIN_SPEED) / (MAX_SPEED - MIN_SPEED);
+            p2 = (p2 < 0) ? 0 : (p2 > 1) ? 1 : p2;
+            printf("%3d threads: %.0f Kops/sec, speedup %.2f, "
+                   "efficiency %.0f%%, thru %.1f/100\n", i, kops,
+                   kops / kops_1, 100.0 * kops / (kops_1 * i), p2 * 100.0);
+        }
+        printf("\n");
+    }
 
-// Return true if the block is free, false otherwise
-static inline int block_free(const uint32_t* block) {
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
+    /*
+     * Fall back to an unweighted average when every trace that ran
+     * correctly has weight 0 (e.g. a single -f correctness trace).
+     */
+    if (weight == 0) {
+        for (i=0; i < num_tracefiles; i++) {
+            if (mm_stats[i].valid) {
+                weight += 1;
+                avg_mm_util += mm_stats[i].util;
+                secs += mm_stats[i].secs;
+                ops += mm_stats[i].ops;
+            }
+        }
+    }
 
-    return !(block[0] & 0x40000000);
-}
+    /*
+     * Accumulate the aggregate statistics for the student's mm package
+     */
+    if (numcorrect == num_tracefiles && weight > 0) {
+        avg_mm_util /= weight;
+        avg_mm_throughput = (secs > 0) ? ops / secs : 0;
+
+        /* Scale utilization and throughput onto [0,1] */
+        p1 = (avg_mm_util - MIN_SPACE) / (MAX_SPACE - MIN_SPACE);
+        p1 = (p1 < 0) ? 0 : (p1 > 1) ? 1 : p1;
+        p2 = (avg_mm_throughput - MIN_SPEED) / (MAX_SPEED - MIN_SPEED);
+        p2 = (p2 < 0) ? 0 : (p2 > 1) ? 1 : p2;
+
+#ifdef ALT_GRADING
+        perfindex = ((p1 < p2) ? p1 : p2) * 100.0;
+        printf("Average utilization = %.1f%%. Average throughput = %.0f Kops/sec\n",
+               avg_mm_util * 100.0, avg_mm_throughput / 1e3);
+        printf("Perf index = %.1f/100 (min of util and thru)\n", perfindex);
+#else
+        perfindex = (UTIL_WEIGHT*p1 + (1.0 - UTIL_WEIGHT)*p2) * 100.0;
+        printf("Average utilization = %.1f%%. Average throughput = %.0f Kops/sec\n",
+               avg_mm_util * 100.0, avg_mm_throughput / 1e3);
+        printf("Perf index = %.1f (util) + %.1f (thru) = %.1f/100\n",
+               UTIL_WEIGHT*p1*100.0, (1.0 - UTIL_WEIGHT)*p2*100.0, perfindex);
+#endif
+        if (mm_fit_stats && fit_searches > 0)
+            printf("Fit policy %s: %.2f free blocks visited per search\n",
+                   fit ? fit : "(built in)", fit_nodes / fit_searches);
+        if (mm_fit_stats && fit_inserts > 0)
+            printf("Free list order %s: %.2f blocks stepped over per insert\n",
+                   order ? order : "(built in)", fit_steps / fit_inserts);
+        if (mm_coalesce_stats)
+            printf("Coalescing: %.0f merges, %.0f splits; %.0f frees deferred, "
+                   "%.0f reused as is, %.0f sweeps\n",
+                   merges, splits, deferred, reused, sweeps);
+    }
+    else { /* There were errors */
+        printf("Terminated with %d errors\n", errors);
+    }
 
-// Mark the given block as free(1)/alloced(0) by marking the header and footer.
-static inline void block_mark(uint32_t* block, int free) {
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
-    free = !free;
-    unsigned int next = block_size(block) + 1;
-    block[0] = free ? block[0] & (int) 0xBFFFFFFF : block[0] | 0x40000000;
-    block[next] = block[0];
-}
+    /*
+     * Clean up
+     */
+    mem_deinit();
+    free(shadow);
+    free(libc_stats);
+    free(mm_stats);
+    free(thread_secs);
+    free(thread_ops);
+    free(perf_counts);
+    if (hist_csv != NULL)
+        fclose(hist_csv);
+    if (tracefiles != default_tracefiles) {
+        for (i = 0; i < num_tracefiles; i++)
+            free(tracefiles[i]);
+        free(tracefiles);
+    }
 
-// Return a pointer to the memory malloc should return
-static inline uint32_t* block_mem(uint32_t* const block) {
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
-    REQUIRES(aligned(block + 1));
-    if (VERBOSE)
-        printf("Heap size = %d bytes \n", (int)mem_heapsize());
-    return block + 1;
+    return (errors > 0) ? 1 : 0;
 }
 
-// Return a pointer to block of what malloc returns
-static inline uint32_t* block_block(uint32_t* const ptr) {
-    REQUIRES(ptr != NULL);
-    REQUIRES(in_heap(ptr - 1));
-    REQUIRES(aligned(ptr));
 
-    return ptr - 1;
-}
+/*****************************************************************
+ * The following routines manipulate the shadow map of live payloads
+ ****************************************************************/
 
-// Return the header to the predecessor free block
-static inline uint32_t* block_pred(uint32_t* const block) {
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
+/*
+ * add_range - As directed by request opnum in trace tracenum,
+ *     we've just called the student's mm_malloc to allocate a block of
+ *     size bytes at addr lo. After checking the block for correctness,
+ *     mark its words as live in the shadow map. The block may lie in
+ *     any arena: the allocator picks one per thread.
+ */
+static int add_range(char *lo, size_t size, int tracenum, int opnum)
+{
+    char *heap_lo = mem_heap_lo();
+    int arena = mem_arena_of(lo);
+    char *arena_hi = arena < 0 ? NULL : (char *)mem_arena_hi(arena);
+    size_t first, last, w;
+
+    /* Payload addresses must be ALIGNMENT-byte aligned */
+    if (!IS_ALIGNED(lo)) {
+        snprintf(msg, sizeof(msg), "Payload address (%p) not aligned to %d bytes",
+                lo, ALIGNMENT);
+        malloc_error(trace_name(tracenum), opnum, msg);
+        return 0;
+    }
 
-    uint32_t * address = heap_listp + block[1];
+    /* A payload outside the arenas must lie in one of the mappings made
+     * with mem_map, which the shadow map does not cover */
+    if (size > 0 && (arena < 0 || lo > arena_hi) && mem_in_map(lo, size))
+        return 1;
 
-    ENSURES(address != NULL);
-    ENSURES(in_heap(address));
+    /* The payload must lie within the extent of its arena */
+    if (size > 0 && arena < 0) {
+        snprintf(msg, sizeof(msg), "Payload (%p:%p) lies outside heap",
+                lo, lo + size - 1);
+        malloc_error(trace_name(tracenum), opnum, msg);
+        return 0;
+    }
+    if (size > 0 && lo + size - 1 > arena_hi) {
+        snprintf(msg, sizeof(msg),
+                "Payload (%p:%p) lies outside heap arena %d (%p:%p)",
+                lo, lo + size - 1, arena, mem_arena_lo(arena), arena_hi);
+        malloc_error(trace_name(tracenum), opnum, msg);
+        return 0;
+    }
+    if (size == 0)
+        return 1;
 
-    if (address == heap_listp)
-        return NULL;
-    else 
-        return address;
+    /* The payload must not overlap any other payload */
+    first = (lo - heap_lo) / ALIGNMENT;
+    last = first + (size + ALIGNMENT - 1) / ALIGNMENT;
+    for (w = first; w < last; w++) {
+        if (shadow[w >> 3] & (1 << (w & 7))) {
+            snprintf(msg, sizeof(msg), "Payload (%p:%p) overlaps another payload at %p",
+                    lo, lo + size - 1, heap_lo + w * ALIGNMENT);
+            malloc_error(trace_name(tracenum), opnum, msg);
+            return 0;
+        }
+        shadow[w >> 3] |= (1 << (w & 7));
+    }
+    if (((last - 1) >> 3) + 1 > shadow_top[arena])
+        shadow_top[arena] = ((last - 1) >> 3) + 1;
+    return 1;
 }
 
-// Return the header to the successor free block
-static inline uint32_t* block_succ(uint32_t* const block) {
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
-
-    uint32_t * address = heap_listp + block[2];
+/*
+ * remove_range - Clear the shadow map for the payload starting at lo
+ */
+static void remove_range(char *lo, size_t size)
+{
+    int arena = mem_arena_of(lo);
+    size_t first, last, w;
 
-    ENSURES(address != NULL);
-    ENSURES(in_heap(address));
+    if (arena < 0 || lo > (char *)mem_arena_hi(arena))
+        return;
+    first = (lo - (char *)mem_heap_lo()) / ALIGNMENT;
+    last = first + (size + ALIGNMENT - 1) / ALIGNMENT;
+    for (w = first; w < last; w++)
+        shadow[w >> 3] &= ~(1 << (w & 7));
+}
 
-    if (address == heap_listp)
-        return NULL;
-    else 
-        return address;
+/*
+ * clear_ranges - Forget every live payload before a new replay
+ */
+static void clear_ranges(void)
+{
+    for (int i = 0; i < MEM_ARENAS; i++) {
+        if (shadow_top[i] > i * SHADOW_ARENA)
+            memset(shadow + i * SHADOW_ARENA, 0,
+                   shadow_top[i] - i * SHADOW_ARENA);
+        shadow_top[i] = 0;
+    }
 }
 
-// Return the header to the previous block
-static inline uint32_t* block_prev(uint32_t* const block) {
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
+/**********************************************
+ * The following routines manipulate tracefiles
+ *********************************************/
 
-    return block - block_size(block - 1) - 2;
+/*
+ * read_trace - read a trace file and store it in memory. A binary trace
+ *     is mapped rather than read, whether it is named directly or was
+ *     converted from the named .rep file since that last changed.
+ */
+static trace_t *read_trace(char *tracedir, char *filename)
+{
+    FILE *tracefile;
+    trace_t *trace;
+    tracebin_t hdr;
+    char path[MAXLINE];
+    char binpath[MAXLINE];
+    int num_ops;
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) calloc(1, sizeof(trace_t))) == NULL)
+        unix_error("malloc 1 failed in read_trace");
+
+    snprintf(path, MAXLINE, "%s%s", tracedir, filename);
+    if (map_trace(trace, path) ||
+        (find_bin(path, binpath) && map_trace(trace, binpath)))
+        goto blocks;
+
+    if (verbose > 1)
+        printf("Reading tracefile: %s\n", filename);
+
+    /* Read the trace file with the parser rep2bin shares */
+    if ((tracefile = fopen(path, "r")) == NULL) {
+        snprintf(msg, sizeof(msg), "Could not open %s in read_trace", path);
+        unix_error(msg);
+    }
+    num_ops = parse_rep(tracefile, path, &hdr, &trace->ops, msg, sizeof(msg));
+    fclose(tracefile);
+    if (num_ops < 0)
+        app_error(msg);
+    if (verbose > 1)
+        printf("weight = %d, num_ids = %d, num_ops = %d, flag = %d\n",
+               hdr.weight, hdr.num_ids, hdr.num_ops, hdr.flag);
+    if (num_ops != hdr.num_ops && verbose > 1)
+        printf("%s: header says %d requests, found %d\n",
+               filename, hdr.num_ops, num_ops);
+    trace->weight = hdr.weight;
+    trace->num_ids = hdr.num_ids;
+    trace->num_ops = num_ops;
+    trace->flag = hdr.flag;
+
+ blocks:
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks =
+         (char **)calloc(trace->num_ids + 1, sizeof(char *))) == NULL)
+        unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes =
+         (size_t *)calloc(trace->num_ids + 1, sizeof(size_t))) == NULL)
+        unix_error("malloc 4 failed in read_trace");
+    return trace;
 }
 
-// Return the header to the next block
-static inline uint32_t* block_next(uint32_t* const block) {
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
+/*
+ * map_trace - If path is a binary trace, map it and point the trace's
+ *     requests into it. Return 0 if path is not a binary trace. The ids
+ *     are checked as they are for a .rep file, which also faults in the
+ *     mapping before any timing starts.
+ */
+static int map_trace(trace_t *trace, char *path)
+{
+    int fd, i;
+    struct stat st;
+    tracebin_t *hdr;
+    traceop_t probe = TRACEBIN_PROBE;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return 0;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(tracebin_t)) {
+        close(fd);
+        return 0;
+    }
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+        unix_error("mmap failed in map_trace");
+    if (hdr->magic != TRACEBIN_MAGIC) {
+        munmap(hdr, st.st_size);
+        return 0;
+    }
+
+    if (verbose > 1)
+        printf("Mapping tracefile: %s\n", path);
+    if (hdr->version != TRACEBIN_VERSION ||
+        memcmp(&hdr->probe, &probe, sizeof(probe)) != 0) {
+        snprintf(msg, sizeof(msg), "%s was written by another version "
+                 "or build of rep2bin; convert it again", path);
+        app_error(msg);
+    }
+    if (hdr->num_ids < 0 || hdr->num_ops < 0 ||
+        (size_t)st.st_size != sizeof(tracebin_t) +
+        (size_t)hdr->num_ops * sizeof(traceop_t)) {
+        snprintf(msg, sizeof(msg), "Malformed header in %s", path);
+        app_error(msg);
+    }
 
-    return block + block_size(block) + 2;
+    trace->weight = hdr->weight;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->flag = hdr->flag;
+    trace->ops = (traceop_t *)(hdr + 1);
+    trace->map = hdr;
+    trace->map_size = st.st_size;
+    for (i = 0; i < trace->num_ops; i++) {
+        if (trace->ops[i].index < -1 || trace->ops[i].index >= trace->num_ids ||
+            (trace->ops[i].index == -1 && trace->ops[i].type != FREE)) {
+            snprintf(msg, sizeof(msg), "Block id %d out of range in %s, "
+                     "request %d", trace->ops[i].index, path, i);
+            app_error(msg);
+        }
+    }
+    return 1;
 }
 
-// Set given value to the given block 
-static inline void set_val(uint32_t* const block, unsigned int val) {
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
+/*
+ * find_bin - Put in binpath the binary trace rep2bin makes from the
+ *     .rep file path, and return 1 if it is there and no older than path
+ */
+static int find_bin(char *path, char *binpath)
+{
+    struct stat rep, bin;
+    size_t len = strlen(path);
 
-    (*(unsigned int *)(block) = val);
+    if (len < 4 || strcmp(path + len - 4, ".rep") != 0)
+        return 0;
+    snprintf(binpath, MAXLINE, "%.*s.bin", (int)(len - 4), path);
+    return stat(path, &rep) == 0 && stat(binpath, &bin) == 0 &&
+        bin.st_mtime >= rep.st_mtime;
 }
 
-// Set the size of the given block in multiples of 4 bytes
-static inline void set_size(uint32_t* const block, unsigned int size) {
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
-    REQUIRES(size % 2 == 0);
+/*
+ * free_trace - Free the trace record and the three arrays it points
+ *              to, all of which were allocated in read_trace(), or
+ *              unmap the binary trace the requests are in.
+ */
+static void free_trace(trace_t *trace)
+{
+    if (trace->map != NULL)   /* unmap or free the three arrays... */
+        munmap(trace->map, trace->map_size);
+    else
+        free(trace->ops);
+    free(trace->blocks);
+    free(trace->block_sizes);
+    free(trace);              /* and the trace record itself... */
+}
 
+/**********************************************************************
+ * The following functions evaluate the correctness, space utilization,
+ * and throughput of the libc and mm malloc packages.
+ **********************************************************************/
 
-    set_val(block, size);
+/*
+ * check_payload - Verify that the first size bytes of the payload at
+ *     p still hold the fill byte written when the block was allocated.
+ */
+static int check_payload(char *p, size_t size, int index)
+{
+    unsigned char fill = (unsigned char)index;
+    size_t j;
+
+    for (j = 0; j < size; j++) {
+        if ((unsigned char)p[j] != fill)
+            return 0;
+    }
+    return 1;
 }
 
 /*
- * Set the pred and succ of the given free block
- * Since the whole memory space is 2^32 bytes
- * I can compress the 8 bytes address into 4 bytes
- * by computing its offest to heap_listp
+ * eval_mm_valid - Check the mm malloc package for correctness
  */
-static inline void set_ptr(uint32_t* const block, 
-                          uint32_t* const pred_block, 
-                          uint32_t* const succ_block) {
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
+static int eval_mm_valid(trace_t *trace, int tracenum)
+{
+    int i;
+    int index;
+    size_t size;
+    size_t oldsize;
+    char *newp;
+    char *oldp;
+    char *p;
+
+    /* Reset the heap and free any records in the shadow map */
+    mem_reset_brk();
+    clear_ranges();
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    memset(trace->block_sizes, 0, trace->num_ids * sizeof(size_t));
+
+    /* Call the mm package's init function */
+    if (mm_init() < 0) {
+        malloc_error(trace_name(tracenum), 0, "mm_init failed.");
+        return 0;
+    }
 
-    unsigned int pred_offest; 
-    unsigned int succ_offest;
+    /* Interpret each operation in the trace in order */
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
 
-    if (pred_block == NULL)
-        pred_offest = 0;
-    else 
-        pred_offest = pred_block - heap_listp;
+        switch (trace->ops[i].type) {
 
-    if (succ_block == NULL)
-        succ_offest = 0;
-    else
-        succ_offest = succ_block - heap_listp;
+        case ALLOC: /* mm_malloc */
 
-    //printf("pred_off = %d, succ_off = %d\n", pred_offest, succ_offest);
-    set_val(block + 1 , pred_offest);
-    set_val(block + 2 , succ_offest);
-    ENSURES(block_pred(block) == pred_block);
-    ENSURES(block_succ(block) == succ_block);    
-}
+            /* Call the student's malloc */
+            if ((p = mm_malloc(size)) == NULL && size != 0) {
+                malloc_error(trace_name(tracenum), i, "mm_malloc failed.");
+                return 0;
+            }
 
+            /*
+             * Test the range of the new block for correctness and add it
+             * to the shadow map if OK. The block must be be aligned properly,
+             * and must not overlap any currently allocated block.
+             */
+            if (p != NULL && add_range(p, size, tracenum, i) == 0)
+                return 0;
+
+            /* Fill the allocated region with a per-id byte value */
+            if (p != NULL)
+                memset(p, index & 0xFF, size);
+
+            /* Remember region */
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
 
-// Return the index to the segregated list according to given words size
-static inline int find_index(unsigned int words) {
-    REQUIRES(words % 2 == 0);
+        case REALLOC: /* mm_realloc */
 
-    if (words == 2) 
-        return 0;
-    else if (words == 4)
-        return 1;
-    else if(words >= 6 && words <= 8)
-        return 2; 
-    else if(words >= 10 && words <= 16)
-        return 3;     
-    else if(words >= 18 && words <= 32)
-        return 4;
-    else if(words >= 34 && words <= 64)
-        return 5;
-    else if(words >= 66 && words <= 128)
-        return 6;
-    else if(words >= 130 && words <= 256)
-        return 7;
-    else if(words >= 258 && words <= 512)
-        return 8;
-    else if(words >= 514 && words <= 1024)
-        return 9;
-    else if(words >= 1026 && words <= 2048)
-        return 10;
-    else if(words >= 2050 && words <= 4096)
-        return 11;
-    else if(words >= 4098 && words <= 8192)
-        return 12;
-    else
-        return 13;
-}
+            /* Call the student's realloc */
+            oldp = trace->blocks[index];
+            oldsize = trace->block_sizes[index];
+            if ((newp = mm_realloc(oldp, size)) == NULL && size != 0) {
+                malloc_error(trace_name(tracenum), i, "mm_realloc failed.");
+                return 0;
+            }
 
-// Return whether the pointer is in the seg list.
-static int in_list(uint32_t* block) {
-    uint32_t *pred = block_pred(block);
-    uint32_t *succ = block_succ(block);
-    int index = find_index(block_size(block));
+            /* Remove the old region from the shadow map */
+            if (oldp != NULL)
+                remove_range(oldp, oldsize);
 
-    if (pred == NULL && succ == NULL) { 
-        // The list has only one block
-        return seg_list[index] == block;
-    } else if (pred == NULL && succ != NULL) {
-        // This block is at the head, seg_list[index] == block
-        return seg_list[index] == block && block_pred(succ) == block;
-    } else if (pred != NULL && succ == NULL) {
-        // This block is at the tail
-        return block_succ(pred) == block;
-    } else {
-        // This block is the middle of somewhere
-        return block_succ(pred) == block && block_pred(succ) == block;
-    }
-}
+            /* A zero-size realloc is a free */
+            if (size == 0) {
+                trace->blocks[index] = NULL;
+                trace->block_sizes[index] = 0;
+                break;
+            }
 
-// Insert the given free block into seg list according to its size
-static inline void block_insert(uint32_t* block) {
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
+            /* Check new block for correctness and add it to shadow map */
+            if (add_range(newp, size, tracenum, i) == 0)
+                return 0;
 
-    int index = find_index(block_size(block));
-    //printf("index = %d, size = %d\n", index, block_size(block));
-    uint32_t *old_block = seg_list[index];
+            /* The old payload must have been preserved */
+            if (!check_payload(newp, (oldsize < size) ? oldsize : size,
+                               index)) {
+                malloc_error(trace_name(tracenum), i,
+                             "mm_realloc did not preserve the data from old block");
+                return 0;
+            }
 
-    if (old_block == NULL) { // this list is empty
-        set_ptr(block, NULL, NULL);
-        seg_list[index] = block;
-    } else {                 // this list is not empty
-        ENSURES(block_pred(old_block) == NULL);
-        ENSURES(block_succ(old_block) == NULL || in_heap(block_succ(old_block)));
+            /* Fill the realloced region with the per-id byte value */
+            memset(newp, index & 0xFF, size);
 
-        set_ptr(old_block, block, block_succ(old_block));
-        set_ptr(block, NULL, old_block);
-        seg_list[index] = block;
-    }
-    ENSURES(in_list(block));
-}
+            /* Remember region */
+            trace->blocks[index] = newp;
+            trace->block_sizes[index] = size;
+            break;
 
-// Delete the given block from the seg list
-static inline void block_delete(uint32_t* block) {
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
+        case FREE: /* mm_free */
 
+            /* free(NULL) must be accepted */
+            if (index == -1) {
+                mm_free(NULL);
+                break;
+            }
 
-    uint32_t *pred = block_pred(block);
-    uint32_t *succ = block_succ(block);
-    int index = find_index(block_size(block));
+            /* Nothing may have scribbled over the payload while it was live */
+            p = trace->blocks[index];
+            size = trace->block_sizes[index];
+            if (p != NULL && !check_payload(p, size, index)) {
+                malloc_error(trace_name(tracenum), i,
+                             "payload was overwritten while allocated");
+                return 0;
+            }
 
-    if (pred == NULL && succ == NULL) { 
-        // The list has only one block
-        seg_list[index] = NULL;
-    } else if (pred == NULL && succ != NULL) {
-        // This block is at the head, seg_list[index] == block
-        set_ptr(succ, NULL, block_succ(succ));
-        seg_list[index] = succ;
-    } else if (pred != NULL && succ == NULL) {
-        // This block is at the tail
-        set_ptr(pred, block_pred(pred), NULL);
-    } else {
-        // This block is the middle of somewhere
-        set_ptr(pred, block_pred(pred), succ);
-        set_ptr(succ, pred, block_succ(succ));
-    }
-}
+            /* Remove region from the shadow map and call student's free */
+            if (p != NULL)
+                remove_range(p, size);
+            mm_free(p);
+            trace->blocks[index] = NULL;
+            trace->block_sizes[index] = 0;
+            break;
 
+        default:
+            app_error("Nonexistent request type in eval_mm_valid");
+        }
 
+        if (checkheap)
+            mm_checkheap(CHECK_FULL);
+    }
 
-// Return the pointer to the last block in the heap.
-static inline uint32_t * last_block() {
-    return block_prev((uint32_t *)((char *)mem_heap_hi() - 3));
+    /* As far as we know, this is a valid malloc package */
+    return 1;
 }
 
-
 /*
- * Merge block with adjacent free blocks
- * Return: the pointer to the new free block 
+ * eval_mm_util - Evaluate the space utilization of the student's package
+ *   The idea is to remember the high water mark "hwm" of the heap for
+ *   an optimal allocator, i.e., no gaps and no internal fragmentation.
+ *   Utilization is the ratio hwm/heapsize, where heapsize is the
+ *   size of the heap in bytes after running the student's malloc
+ *   package on the trace. Note that our implementation of mem_sbrk()
+ *   doesn't allow the students to decrement the brk pointer, so brk
+ *   is always the high water mark of the heap. Blocks mapped outside
+ *   the heap with mem_map count too: heapsize is the most heap plus
+ *   mapped bytes in use at once.
+ *
  */
-static void *coalesce(void *block) {
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
-
-    uint32_t *prev_block = block_prev(block);
-    uint32_t *next_block = block_next(block);
-    int prev_free = block_free(prev_block);
-    int next_free = block_free(next_block);
-    unsigned int words = block_size(block);
-    
+static double eval_mm_util(trace_t *trace, int tracenum)
+{
+    int i;
+    int index;
+    size_t size, newsize, oldsize;
+    size_t max_total_size = 0;
+    size_t total_size = 0;
+    char *p;
+    char *newp, *oldp;
+    struct mm_tcache_stats tc_before, tc_after;
+    struct mm_realloc_stats rs_before, rs_after;
+    struct mm_remote_stats rf_before, rf_after;
+    size_t trimmed;
+
+    if (mm_tcache_stats)
+        mm_tcache_stats(&tc_before);
+    if (mm_realloc_stats)
+        mm_realloc_stats(&rs_before);
+    if (mm_remote_stats)
+        mm_remote_stats(&rf_before);
+
+    /* initialize the heap and the mm malloc package */
+    mem_reset_brk();
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    memset(trace->block_sizes, 0, trace->num_ids * sizeof(size_t));
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_util");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_alloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+
+            if ((p = mm_malloc(size)) == NULL && size != 0)
+                app_error("mm_malloc failed in eval_mm_util");
+
+            /* Remember region and size */
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+
+            /* Keep track of current total size
+             * of all allocated blocks */
+            total_size += size;
+            break;
 
-    if (prev_free && next_free) {       // Case 4, both free
+        case REALLOC: /* mm_realloc */
+            index = trace->ops[i].index;
+            newsize = trace->ops[i].size;
+            oldsize = trace->block_sizes[index];
 
-        block_delete(prev_block);
-        block_delete(next_block);
+            oldp = trace->blocks[index];
+            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
+                app_error("mm_realloc failed in eval_mm_util");
 
-        words += block_size(prev_block) + block_size(next_block) + 4;
-        set_size(prev_block, words);
-        block_mark(prev_block, FREE);
-        block = (void *)prev_block;
+            /* Remember region and size */
+            trace->blocks[index] = newp;
+            trace->block_sizes[index] = newsize;
 
-        block_insert(block);
-        ENSURES(in_list(block));    
-    }
-
-    else if (!prev_free && next_free) { // Case 2, next if free
+            /* Adjust current total size of all allocated blocks */
+            total_size += (newsize - oldsize);
+            break;
 
-        block_delete(next_block);
+        case FREE: /* mm_free */
+            index = trace->ops[i].index;
+            if (index == -1) {
+                mm_free(NULL);
+                break;
+            }
+            size = trace->block_sizes[index];
+            p = trace->blocks[index];
 
-        words += block_size(next_block) + 2;
-        set_size(block, words);
-        block_mark(block, FREE);  
+            mm_free(p);
+            trace->blocks[index] = NULL;
+            trace->block_sizes[index] = 0;
 
-        block_insert(block);
-        ENSURES(in_list(block));      
-    }
+            /* Keep track of current total size
+             * of all allocated blocks */
+            total_size -= size;
+            break;
 
-    else if (prev_free && !next_free) { // Case 3, prev is free
-        block_delete(prev_block);
+        default:
+            app_error("Nonexistent request type in eval_mm_util");
 
-        words += block_size(prev_block) + 2;
-        set_size(prev_block, words);
-        block_mark(prev_block, FREE);
-        block = (void *)prev_block;
+        }
 
-        block_insert(block);
-        ENSURES(in_list(block));
+        /* update the high-water mark of live payload bytes */
+        max_total_size = (max_total_size > total_size) ?
+            max_total_size : total_size;
     }
 
-    else {                              // Case 1, both unfree
-        block_insert(block);
-        ENSURES(in_list(block));
-        return block;
+    if (verbose > 1)
+        printf("%s: peak payload %lu bytes, heap %lu bytes, "
+               "peak heap + mapped %lu bytes\n",
+               trace_name(tracenum), (unsigned long)max_total_size,
+               (unsigned long)mem_heapsize(), (unsigned long)mem_peaksize());
+    if (verbose > 1) {
+        printf("%s: resident %lu of %lu mapped bytes", trace_name(tracenum),
+               (unsigned long)mem_resident(),
+               (unsigned long)(mem_heapsize() + mem_mapsize()));
+        if (mm_trim) {
+            trimmed = mm_trim();
+            printf(", mm_trim gave back %lu, leaving %lu of %lu",
+                   (unsigned long)trimmed, (unsigned long)mem_resident(),
+                   (unsigned long)(mem_heapsize() + mem_mapsize()));
+        }
+        printf("\n");
+    }
+    if (verbose > 1 && mm_tcache_stats) {
+        mm_tcache_stats(&tc_after);
+        printf("%s: tcache %lu hits, %lu misses, %lu flushes, %lu refills\n",
+               trace_name(tracenum), tc_after.hits - tc_before.hits,
+               tc_after.misses - tc_before.misses,
+               tc_after.flushes - tc_before.flushes,
+               tc_after.refills - tc_before.refills);
     }
-    return block;
- } 
+    if (verbose > 1 && mm_realloc_stats) {
+        mm_realloc_stats(&rs_after);
+        printf("%s: realloc %lu in place, %lu into next, %lu at heap end, "
+               "%lu into prev, %lu remapped, %lu copied\n",
+               trace_name(tracenum),
+               rs_after.in_place - rs_before.in_place,
+               rs_after.grow_next - rs_before.grow_next,
+               rs_after.grow_tail - rs_before.grow_tail,
+               rs_after.grow_prev - rs_before.grow_prev,
+               rs_after.remap - rs_before.remap,
+               rs_after.copies - rs_before.copies);
+        printf("%s: realloc %lu into headroom, %lu bytes copied, "
+               "%lu copy bytes saved, %lu headroom bytes\n",
+               trace_name(tracenum), rs_after.headroom - rs_before.headroom,
+               rs_after.copy_bytes - rs_before.copy_bytes,
+               rs_after.saved_bytes - rs_before.saved_bytes,
+               rs_after.headroom_bytes - rs_before.headroom_bytes);
+    }
+    if (verbose > 1 && mm_remote_stats) {
+        mm_remote_stats(&rf_after);
+        printf("%s: remote %lu frees, %lu bytes, %lu drains of %lu blocks\n",
+               trace_name(tracenum), rf_after.frees - rf_before.frees,
+               rf_after.bytes - rf_before.bytes,
+               rf_after.drains - rf_before.drains,
+               rf_after.drained - rf_before.drained);
+    }
+    return ((double)max_total_size / (double)mem_peaksize());
+}
 
 /*
- * Extends the heap with a new free block
- * Return: the pointer to the new free block 
- *         NULL on error.
+ * eval_mm_frag - Replay the trace up to the first request after which
+ *     its live payload peaks, and report how mm_frag_stats finds the
+ *     heap then. The payload is known from the driver's own sizes of
+ *     the live blocks; the rest of the bytes in use are internal
+ *     fragmentation.
  */
-static void *extend_heap(unsigned int words) {
-    REQUIRES(words > 4);
+static void eval_mm_frag(trace_t *trace, int tracenum)
+{
+    int i, k, peak = -1;
+    int index;
+    size_t size, total_size = 0, max_total_size = 0;
+    char *p;
+    struct mm_frag_stats f;
+
+    /* Find the peak without allocating */
+    memset(trace->block_sizes, 0, trace->num_ids * sizeof(size_t));
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        if (trace->ops[i].type == FREE && index == -1)
+            continue;
+        total_size -= trace->block_sizes[index];
+        trace->block_sizes[index] = (trace->ops[i].type == FREE) ?
+            0 : trace->ops[i].size;
+        total_size += trace->block_sizes[index];
+        if (total_size > max_total_size || peak < 0) {
+            max_total_size = total_size;
+            peak = i;
+        }
+    }
 
-    uint32_t *block;
-    uint32_t *next;
-    
+    mem_reset_brk();
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    memset(trace->block_sizes, 0, trace->num_ids * sizeof(size_t));
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_frag");
+
+    for (i = 0; i <= peak; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+        case ALLOC:
+            if ((p = mm_malloc(size)) == NULL && size != 0)
+                app_error("mm_malloc failed in eval_mm_frag");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+        case REALLOC:
+            if ((p = mm_realloc(trace->blocks[index], size)) == NULL &&
+                size != 0)
+                app_error("mm_realloc failed in eval_mm_frag");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+        case FREE:
+            if (index == -1) {
+                mm_free(NULL);
+                break;
+            }
+            mm_free(trace->blocks[index]);
+            trace->blocks[index] = NULL;
+            trace->block_sizes[index] = 0;
+            break;
+        default:
+            app_error("Nonexistent request type in eval_mm_frag");
+        }
+    }
 
-    /* Ask for 2 more words for header and footer */
-    words = (words % 2) ? (words + 1) : words;
-    if (VERBOSE)
-        printf("Extend Words = %d bytes\n", words * 4);
-    if ((long)(block = mem_sbrk(words * WSIZE)) == -1)
-        return NULL;
+    mm_frag_stats(&f);
+    printf("\n%s: fragmentation at peak payload, after request %d of %d\n",
+           trace_name(tracenum), peak + 1, trace->num_ops);
+    if (f.heap == 0)
+        return;
+#define FRAG_LINE(label, bytes, note) \
+    printf("  %-10s %10lu %6.1f%%  %s\n", label, (unsigned long)(bytes), \
+           100.0 * (double)(bytes) / f.heap, note)
+    FRAG_LINE("heap", f.heap, "");
+    FRAG_LINE("payload", max_total_size, "requested by the live blocks");
+    FRAG_LINE("tags", f.tags, "headers and footers (internal)");
+    FRAG_LINE("padding", f.used - f.tags - max_total_size,
+              "alignment and slack past the requests (internal)");
+    FRAG_LINE("free", f.free_bytes, "free blocks (external)");
+    FRAG_LINE("cached", f.cached, "freed blocks held back for reuse");
+    FRAG_LINE("run idle", f.run_idle, "slab run space outside objects");
+    FRAG_LINE("other", f.other, "list heads, prologue and epilogue");
+#undef FRAG_LINE
+    printf("  %lu blocks in use, %lu free; largest free %lu bytes, "
+           "%.1f%% of free bytes\n", f.used_blocks, f.free_blocks,
+           (unsigned long)f.largest_free, f.free_bytes ?
+           100.0 * f.largest_free / f.free_bytes : 0.0);
+    if (f.free_blocks == 0)
+        return;
+    printf("  free blocks by size:\n");
+    for (k = 0; k < MM_FRAG_BINS; k++)
+        if (f.free_hist[k] > 0)
+            printf("    %10lu - %-10lu %8lu blocks %10lu bytes\n",
+                   1UL << k, (2UL << k) - 1, f.free_hist[k],
+                   (unsigned long)f.free_hist_bytes[k]);
+    printf("  free blocks by seg list:\n");
+    for (k = 0; k < (int)f.segs; k++)
+        if (f.seg_blocks[k] > 0) {
+            if (f.seg_bound[k] > 0)
+                printf("    seg %2d <= %-10lu", k,
+                       (unsigned long)f.seg_bound[k]);
+            else
+                printf("    seg %2d    %-10s", k, "larger");
+            printf("%8lu blocks %10lu bytes\n", f.seg_blocks[k],
+                   (unsigned long)f.seg_bytes[k]);
+        }
+}
+
+
+/*
+ * eval_mm_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the mm malloc package.
+ */
+static void eval_mm_speed(void *ptr)
+{
+    int i, index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    /* Reset the heap and initialize the mm package. Ids that a trace
+     * frees before allocating must see NULL, not a previous run's block */
+    mem_reset_brk();
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_speed");
+
+    /* Interpret each trace request */
+    for (i = 0;  i < trace->num_ops;  i++)
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_malloc(size)) == NULL && size != 0)
+                app_error("mm_malloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
 
-    block--;          // back step 1 since the last one is the epi block
-    set_size(block, words - 2);
-    block_mark(block, FREE);
+        case REALLOC: /* mm_realloc */
+            index = trace->ops[i].index;
+            newsize = trace->ops[i].size;
+            oldp = trace->blocks[index];
+            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
+                app_error("mm_realloc error in eval_mm_speed");
+            trace->blocks[index] = newp;
+            break;
 
-    ENSURES(block != NULL);
-    // New eqilogue block
-    next = block_next(block);    
-    set_size(next, 0);
-    *next |= 0x40000000;
-    //block_mark(block_next(block), ALLOCATED);
+        case FREE: /* mm_free */
+            index = trace->ops[i].index;
+            block = (index == -1) ? NULL : trace->blocks[index];
+            mm_free(block);
+            if (index != -1)
+                trace->blocks[index] = NULL;
+            break;
 
-    ENSURES(!block_free(next));
-    ENSURES(block_size(next) == 0);
-    block = coalesce(block);    // Coalesce if necessary
-    ENSURES(in_list(block));
-    return block;
- }
+        default:
+            app_error("Nonexistent request type in eval_mm_speed");
+        }
+}
 
 /*
- * Find the fit using first fit search
- * Return: the pointer to the found free block 
- *         NULL on no matching.
+ * eval_mm_threads - Replay the trace with 1 to nthreads threads sharing
+ *    the mm package, and print the throughput, speedup, efficiency
+ *    (speedup per thread) and per-thread latency at each thread count.
+ *    The times and request counts are added to thread_secs and
+ *    thread_ops, indexed by thread count.
  */
-static void *find_fit(unsigned int awords) {
-    REQUIRES(awords >= 2);
-    REQUIRES(awords % 2 == 0);
+static void eval_mm_threads(trace_t *trace, int tracenum,
+                            double *thread_secs, double *thread_ops)
+{
+    int n, run;
+    double secs, best = 0, ops, kops, kops_1 = 0;
+    double lat[3], best_lat[3] = {0, 0, 0};
+
+    printf("%s: %s replay\n", trace_name(tracenum), replay_names[replay]);
+    printf("%8s%10s%9s%7s%24s\n",
+           "threads", "Kops", "speedup", "eff", "ns/op min/avg/max");
+    for (n = 1; n <= nthreads; n++) {
+        run_threads(trace, n, lat); /* untimed, to fault in the heap */
+        for (run = 0; run < THREAD_RUNS; run++) {
+            secs = run_threads(trace, n, lat);
+            if (run == 0 || secs < best) {
+                best = secs;
+                memcpy(best_lat, lat, sizeof(lat));
+            }
+        }
+        ops = (replay == COPY) ? (double)n * trace->num_ops : trace->num_ops;
+        kops = ops / 1e3 / best;
+        if (n == 1)
+            kops_1 = kops;
+        printf("%8d%10.0f%9.2f%6.0f%%%10.0f%7.0f%7.0f\n", n, kops,
+               kops / kops_1, 100.0 * kops / (kops_1 * n),
+               best_lat[0], best_lat[1], best_lat[2]);
+        thread_secs[n] += best;
+        thread_ops[n] += ops;
+    }
+}
 
-    uint32_t *block = NULL;
-    uint32_t *res = block;
-    int found = 0;
-    unsigned int words = 1 << 31;
-    unsigned int thiswords = 0;
-    int index = find_index(awords);
+/*
+ * run_threads - Replay the trace once with n threads, each on its share
+ *    of the requests, and return the time from the first one starting
+ *    to the last one finishing. lat gets the min, mean and max over the
+ *    threads of their time per request, in ns.
+ */
+static double run_threads(trace_t *trace, int n, double *lat)
+{
+    worker_t *w;
+    handoff_t *boxes = NULL;
+    pthread_barrier_t start;
+    int i, t, busy;
+    double begin, end, ns;
+
+    w = calloc(n, sizeof(worker_t));
+    if (w == NULL)
+        unix_error("calloc failed in run_threads");
+    if (replay == CROSS && n > 1 &&
+        (boxes = calloc(n, sizeof(handoff_t))) == NULL)
+        unix_error("calloc failed in run_threads");
+
+    /* Hand out the requests. Ids are split into n equal ranges; freeing
+     * NULL goes to thread 0 */
+    for (t = 0; t < n; t++) {
+        w[t].blocks = calloc(trace->num_ids + 1, sizeof(char *));
+        if (replay == COPY) {
+            w[t].ops = trace->ops;
+            w[t].num_ops = trace->num_ops;
+        }
+        else
+            w[t].ops = malloc((trace->num_ops + 1) * sizeof(traceop_t));
+        if (w[t].blocks == NULL || w[t].ops == NULL)
+            unix_error("malloc failed in run_threads");
+        if (boxes != NULL) {
+            w[t].inbox = &boxes[t];
+            w[t].outbox = &boxes[(t + 1) % n];
+        }
+        w[t].start = &start;
+    }
+    if (replay != COPY) {
+        for (i = 0; i < trace->num_ops; i++) {
+            t = (trace->ops[i].index < 0) ? 0 :
+                (int)((long)trace->ops[i].index * n / trace->num_ids);
+            w[t].ops[w[t].num_ops++] = trace->ops[i];
+        }
+    }
 
-    for (int i = index; i < SEG_LIST_SIZE; ++i) {
-        //printf("index in finding = %d\n", i);        
-        if (seg_list[i] == NULL)
+    /* Reset the heap, then start every thread at once */
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in run_threads");
+    pthread_barrier_init(&start, NULL, n + 1);
+    for (t = 0; t < n; t++) {
+        if (pthread_create(&w[t].tid, NULL, replay_thread, &w[t]) != 0)
+            unix_error("pthread_create failed in run_threads");
+    }
+    pthread_barrier_wait(&start);
+    for (t = 0; t < n; t++)
+        pthread_join(w[t].tid, NULL);
+    pthread_barrier_destroy(&start);
+
+    /* Blocks still in flight when their consumer finished */
+    for (t = 0; boxes != NULL && t < n; t++)
+        drain_handoff(&boxes[t]);
+
+    begin = w[0].begin;
+    end = w[0].end;
+    lat[0] = lat[1] = lat[2] = 0;
+    busy = 0;
+    for (t = 0; t < n; t++) {
+        begin = (w[t].begin < begin) ? w[t].begin : begin;
+        end = (w[t].end > end) ? w[t].end : end;
+        if (w[t].num_ops == 0)
             continue;
-        for (block = seg_list[i]; block != NULL; block = block_succ(block)) {
-            thiswords = block_size(block);
-            if (thiswords >= awords) {
-                if (thiswords < words) {
-                    res = block;
-                    words = thiswords;
-                }
-                found = 1;
-                //return block;
-            }
-        }
-        if (found) 
-            break;
+        ns = (w[t].end - w[t].begin) * 1e9 / w[t].num_ops;
+        lat[0] = (busy == 0 || ns < lat[0]) ? ns : lat[0];
+        lat[1] += ns;
+        lat[2] = (ns > lat[2]) ? ns : lat[2];
+        busy++;
     }
-    return res;
- }
+    if (busy > 0)
+        lat[1] /= busy;
+
+    for (t = 0; t < n; t++) {
+        free(w[t].blocks);
+        if (replay != COPY)
+            free(w[t].ops);
+    }
+    free(boxes);
+    free(w);
+    return end - begin;
+}
 
 /*
- * Place the block and potentially split the block
- * Return: Nothing
+ * replay_thread - Body of one replay thread: wait for the others, then
+ *    run its requests, in CROSS mode freeing the blocks the previous
+ *    thread handed over before each one
  */
-static void place(void *block, unsigned int awords) {
-    REQUIRES(awords >= 2 && awords % 2 == 0);
-    REQUIRES(block != NULL);
-    REQUIRES(in_heap(block));
-    REQUIRES(in_list(block));
+static void *replay_thread(void *arg)
+{
+    worker_t *w = (worker_t *)arg;
+    traceop_t *op;
+    char *p;
+    int i;
+
+    pthread_barrier_wait(w->start);
+    w->begin = wall_secs();
+    for (i = 0; i < w->num_ops; i++) {
+        if (w->inbox != NULL)
+            drain_handoff(w->inbox);
+        op = &w->ops[i];
+        switch (op->type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(op->size)) == NULL && op->size != 0)
+                app_error("mm_malloc error in replay_thread");
+            w->blocks[op->index] = p;
+            break;
 
-    unsigned int cwords = block_size(block); //the size of the given freeblock
-    block_delete(block);      // delete block from the seg list
-    
-    ENSURES(!in_list(block));
+        case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(w->blocks[op->index], op->size)) == NULL &&
+                op->size != 0)
+                app_error("mm_realloc error in replay_thread");
+            w->blocks[op->index] = p;
+            break;
 
-    if ((cwords - awords) >= 4) {
-        set_size(block, awords);
-        block_mark(block, ALLOCATED);
-        block = block_next(block);
-        set_size(block, cwords - awords - 2);
-        block_mark(block, FREE);
-        block_insert(block);
+        case FREE: /* mm_free, or pass the block on when the ring has room */
+            if (op->index == -1) {
+                mm_free(NULL);
+                break;
+            }
+            p = w->blocks[op->index];
+            w->blocks[op->index] = NULL;
+            if (w->outbox == NULL || !put_handoff(w->outbox, p))
+                mm_free(p);
+            break;
 
-        ENSURES(in_list(block));
-    } else {
-        set_size(block, cwords);
-        block_mark(block, ALLOCATED);
-    }    
- }
+        default:
+            app_error("Nonexistent request type in replay_thread");
+        }
+    }
+    w->end = wall_secs();
+    return NULL;
+}
 
 /*
- *  Malloc Implementation
- *  ---------------------
- *  The following functions deal with the user-facing malloc implementation.
+ * put_handoff - Queue block p for the consumer of ring h. Returns 0 if
+ *    the ring is full.
  */
+static int put_handoff(handoff_t *h, char *p)
+{
+    unsigned int tail = h->tail;
+
+    if (tail - h->head == HANDOFF_SIZE)
+        return 0;
+    h->slot[tail % HANDOFF_SIZE] = p;
+    __sync_synchronize();    /* the slot is written before it is published */
+    h->tail = tail + 1;
+    return 1;
+}
 
 /*
- * Initialize: return -1 on error, 0 on success.
+ * drain_handoff - Free every block queued on ring h
  */
-int mm_init(void) {
+static void drain_handoff(handoff_t *h)
+{
+    unsigned int head = h->head;
+    unsigned int tail = h->tail;
 
-    /* Initialize the seg_list with NULL */
-    seg_list = mem_sbrk(SEG_LIST_SIZE * sizeof(uint32_t *));
-    for (int i = 0; i < SEG_LIST_SIZE; ++i) {
-        seg_list[i] = NULL;
-    }
+    if (head == tail)
+        return;
+    __sync_synchronize();    /* the slots are read after the tail */
+    for (; head != tail; head++)
+        mm_free(h->slot[head % HANDOFF_SIZE]);
+    __sync_synchronize();    /* ... and before the producer may reuse them */
+    h->head = head;
+}
 
-    if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1)
-        return -1;
-    set_size(heap_listp, 0);                 // Allignment padding
-    set_size(heap_listp + 1, 0);             // Pro of 0 size
-    set_size(heap_listp + 3, 0);             // Epi of 0 size
-    (heap_listp + 3)[0] |= 0x40000000;       // Mark epi as allocated
-    block_mark(heap_listp + 1, ALLOCATED);   // Mark prologue as allocated
+/*
+ * wall_secs - Return the time in seconds on the monotonic clock
+ */
+static double wall_secs(void)
+{
+    struct timespec ts;
 
-    heap_listp += 1;                            
-    
-    /* Extend the empty heap with a free block of CHUNKSIZE bytes 
-     * extend_heap would ask for 2 more words */
-    if (extend_heap(CHUNKSIZE + 2) == NULL)
-        return -1;
-    return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
 }
 
-
+/*
+ * Latency histograms. Requests are timed with start_counter and
+ * get_counter, less the cost ovhd measures for that pair, and binned
+ * by type and by request size (for frees, the size of the block).
+ */
+static char *lat_types[LAT_TYPES] = {"malloc", "free", "realloc"};
+static const size_t lat_bounds[LAT_CLASSES - 1] = {64, 512, 4096, 32768};
+static struct size_classes lat_classes;
+static hist_t lat_hist[LAT_TYPES][LAT_CLASSES];
+static double lat_ovhd;          /* ticks the counter itself takes */
+static double lat_mhz;
 
 /*
- * malloc
+ * init_latency - Measure the counter overhead and clock rate, and open
+ *    the CSV file if there is one
  */
-void *malloc (size_t size) {
-    checkheap(1);  // Let's make sure the heap is ok!
-    unsigned int awords;  //Adjusted block size
-    unsigned int ewords;  //Amount to extend heap if no matching
-    uint32_t *block;
-    uint32_t * heap_lastp = last_block();
+static void init_latency(char *csvname)
+{
+    int i;
+    double o;
+
+    sizeclass_init(&lat_classes, lat_bounds, LAT_CLASSES - 1);
+    lat_ovhd = ovhd();
+    for (i = 0; i < 10; i++) {
+        o = ovhd();
+        lat_ovhd = (o < lat_ovhd) ? o : lat_ovhd;
+    }
+    if ((lat_mhz = mhz(0)) <= 0)
+        app_error("Cannot read the clock rate for -H");
+    if (verbose)
+        printf("Timing requests at %.1f MHz, less %.0f ticks each\n",
+               lat_mhz, lat_ovhd);
 
-    if (VERBOSE)
-        printf("Malloc %d bytes\n", (int)size);
+    if (csvname == NULL)
+        return;
+    if ((hist_csv = fopen(csvname, "w")) == NULL) {
+        sprintf(msg, "Could not open %s in init_latency", csvname);
+        unix_error(msg);
+    }
+    fprintf(hist_csv, "trace,op,size_lo,size_hi,"
+            "ticks_lo,ticks_hi,ns_lo,ns_hi,count\n");
+}
 
-    /* Ignore 0 requests */
-    if (size == 0)
-        return NULL;
-    /* Adjust size to include alignment and convert to multipes of 4 bytes */
-    if (size <= DSIZE)
-        awords = 2;
-    else
-        awords = (((size) + (DSIZE-1)) & ~0x7) / WSIZE;
+/*
+ * eval_mm_latency - Replay the trace once, untimed, to warm up, then
+ *    again timing every request. Print the latency percentiles of each
+ *    request type (and with -V, of each size class), and append the
+ *    histograms to the CSV file.
+ */
+static void eval_mm_latency(trace_t *trace, int tracenum)
+{
+    speed_t speed_params;
+    traceop_t *op;
+    char *p;
+    int i, t, c, b, size = 0;
+    size_t lo;
+    double cycles = 0;
+    char label[MAXLINE];
+
+    speed_params.trace = trace;
+    eval_mm_speed(&speed_params);
+
+    mem_reset_brk();
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+    memset(lat_hist, 0, sizeof(lat_hist));
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        op = &trace->ops[i];
+        switch (op->type) {
+
+        case ALLOC: /* mm_malloc */
+            start_counter();
+            p = mm_malloc(op->size);
+            cycles = get_counter();
+            if (p == NULL && op->size != 0)
+                app_error("mm_malloc error in eval_mm_latency");
+            trace->blocks[op->index] = p;
+            trace->block_sizes[op->index] = size = op->size;
+            break;
 
+        case REALLOC: /* mm_realloc */
+            start_counter();
+            p = mm_realloc(trace->blocks[op->index], op->size);
+            cycles = get_counter();
+            if (p == NULL && op->size != 0)
+                app_error("mm_realloc error in eval_mm_latency");
+            trace->blocks[op->index] = p;
+            trace->block_sizes[op->index] = size = op->size;
+            break;
 
+        case FREE: /* mm_free */
+            p = (op->index == -1) ? NULL : trace->blocks[op->index];
+            size = (op->index == -1) ? 0 : trace->block_sizes[op->index];
+            start_counter();
+            mm_free(p);
+            cycles = get_counter();
+            if (op->index != -1)
+                trace->blocks[op->index] = NULL;
+            break;
 
-    /* Search the free list for a fit */
-    if ((block = find_fit(awords)) != NULL) {
-        place(block, awords);
-        //printf("3\n");
-        return block_mem(block);        
+        default:
+            app_error("Nonexistent request type in eval_mm_latency");
+        }
+        hist_add(&lat_hist[op->type][size_class(&lat_classes, size)],
+                 cycles - lat_ovhd);
     }
 
-    /* No fit found. Get more memory and place the block */ 
-    if (awords > CHUNKSIZE)
-        ewords = awords;
-    else if (0)
-        ewords = awords;
-    else
-        ewords = CHUNKSIZE;
-    if (block_free(heap_lastp)) {
-        ENSURES(block_size(heap_lastp) < ewords);
-        ewords = ewords - block_size(heap_lastp) + 2;
-        //ewords += 2;
-        //printf("1\n");
-    } else {
-        ewords += 2;  // ask for 2 more for the header and footer
-        //printf("2\n");
+    printf("%s: latency in ns\n", trace_name(tracenum));
+    printf("  %-20s%9s%8s%8s%8s%8s\n",
+           "request", "count", "p50", "p99", "p99.9", "max");
+    for (t = 0; t < LAT_TYPES; t++) {
+        print_latency(lat_hist[t], LAT_CLASSES, lat_types[t]);
+        for (c = 0; verbose > 1 && c < LAT_CLASSES; c++) {
+            lo = (c == 0) ? 0 : lat_bounds[c - 1] + 1;
+            if (c < LAT_CLASSES - 1)
+                sprintf(label, "  %lu-%lu", (unsigned long)lo,
+                        (unsigned long)lat_bounds[c]);
+            else
+                sprintf(label, "  %lu+", (unsigned long)lo);
+            print_latency(&lat_hist[t][c], 1, label);
+        }
     }
 
-    if ((block = extend_heap(ewords)) == NULL)
-            return NULL;
-    place(block, awords);
-    return block_mem(block);
+    for (t = 0; hist_csv != NULL && t < LAT_TYPES; t++) {
+        for (c = 0; c < LAT_CLASSES; c++) {
+            for (b = 0; b < HIST_BUCKETS; b++) {
+                if (lat_hist[t][c].count[b] == 0)
+                    continue;
+                fprintf(hist_csv, "%s,%s,%lu,", trace_name(tracenum),
+                        lat_types[t], (c == 0) ? 0UL :
+                        (unsigned long)lat_bounds[c - 1] + 1);
+                if (c < LAT_CLASSES - 1)
+                    fprintf(hist_csv, "%lu,", (unsigned long)lat_bounds[c]);
+                else
+                    fprintf(hist_csv, ",");
+                fprintf(hist_csv, "%lu,%lu,%.1f,%.1f,%lu\n",
+                        hist_lo(b), hist_hi(b), hist_lo(b) * 1e3 / lat_mhz,
+                        hist_hi(b) * 1e3 / lat_mhz, lat_hist[t][c].count[b]);
+            }
+        }
+    }
 }
 
 /*
- * free
+ * print_latency - Print one line of percentiles over the n histograms
+ *    in h, if they hold any samples
  */
-void free (void *ptr) {
-    /* If ptr is NULL, no operation is performed. */    
-    if (ptr == NULL)
+static void print_latency(hist_t *h, int n, char *label)
+{
+    int i;
+    unsigned long total = 0;
+    double max = 0;
+
+    for (i = 0; i < n; i++) {
+        total += h[i].total;
+        max = (h[i].max > max) ? h[i].max : max;
+    }
+    if (total == 0)
         return;
-
-    uint32_t* block = block_block(ptr);
-
-    block_mark(block, FREE);
-    coalesce(block);
+    printf("  %-20s%9lu%8.0f%8.0f%8.0f%8.0f\n", label, total,
+           hist_percentile(h, n, 0.5) * 1e3 / lat_mhz,
+           hist_percentile(h, n, 0.99) * 1e3 / lat_mhz,
+           hist_percentile(h, n, 0.999) * 1e3 / lat_mhz,
+           max * 1e3 / lat_mhz);
 }
 
 /*
- * realloc - you may want to look at mm-naive.c
+ * hist_add - Count a sample of the given number of cycles. Samples the
+ *    counter overhead made negative count as 0.
  */
-void *realloc(void *oldptr, size_t size) {
-    if (oldptr == NULL)   // if oldptr is NULL, this works as malloc(size)
-        return malloc(size);
-    if (size == 0) {      // if size is 0, this works as free(oldptr)
-        free(oldptr);
-        return NULL;
+static void hist_add(hist_t *h, double cycles)
+{
+    unsigned long v;
+    int shift, bucket;
+
+    cycles = (cycles < 0) ? 0 : cycles;
+    v = (unsigned long)cycles;
+    if (v < HIST_SUB)
+        bucket = v;
+    else {
+        shift = 63 - __builtin_clzl(v) - HIST_SUB_BITS;
+        bucket = (shift + 1) * HIST_SUB + (int)(v >> shift) - HIST_SUB;
     }
+    h->count[bucket]++;
+    h->total++;
+    h->max = (cycles > h->max) ? cycles : h->max;
+}
 
-    uint32_t *block = block_block(oldptr);
-
-    REQUIRES(in_heap(block));
-    REQUIRES(!block_free(block));
-
-
-
-    unsigned int words = block_size(block);  // old size in words
-    unsigned int nwords;                      // new size in words
-    uint32_t * ptr;                           // temp ptr
-
-    /* Adjust size to include alignment and convert to multipes of 4 bytes */
-    if (size <= DSIZE)
-        nwords = 2;
-    else
-        nwords = (((size) + (DSIZE-1)) & ~0x7) / WSIZE;
-
-    /* if new size is the same as old size or the old size is larger but no larger
-     * than 4 words, return oldptr without spliting */
-    //printf("RE, words = %d, nwords = %d\n", words, nwords);
-    if (nwords == words || (words > nwords && words - nwords < 4))
-        return oldptr;
-    else if (nwords < words) {
-        /* if old size is at least 4 words larger than new size
-         * return oldptr with spliting */      
-        set_size(block, nwords);
-        block_mark(block, ALLOCATED);
-        ptr = block_next(block);
-        ENSURES(words - nwords - 2 < words);
-        set_size(ptr, words - nwords - 2);
-        block_mark(ptr, FREE);
-        block_insert(ptr);
-        return oldptr;
-    } else {
-        /* if old size is smaller than new size, look for more space */
-
-        ptr = block_next(block);
-        if (block_free(ptr)) {
-            ENSURES(in_list(ptr));
-
-            // if next block is free
-            unsigned int owords = block_size(ptr);  //size of next blockdd
-            int remain = owords + 2 - (nwords - words);
-            if (remain >= 4) {
-                // the next free block is enough large to split
-                block_delete(ptr);
-                set_size(block, nwords);
-                block_mark(block, ALLOCATED);
-                ptr = block_next(block);
-                set_size(ptr, owords - (nwords - words));
-                block_mark(ptr, FREE);
-                block_insert(ptr);
-                return oldptr;
-            } else if (remain >= 0) {
-                // the next free block can not split
-                block_delete(ptr);
-                set_size(block, words + owords + 2);
-                block_mark(block, ALLOCATED);
-                return oldptr;
-            }
-        } 
-        /* the next free block is too small, or
-         * next block is not free, malloc whole new one. */
-        ptr = malloc(size);
-        /* Copy the old data. */
-        memcpy(ptr, oldptr, block_size(block) * WSIZE);
-        /* Free the old block. */
-        free(oldptr);
-        return ptr;
+/*
+ * hist_percentile - Return the sample at fraction q of the way through
+ *    the n histograms in h, to within its bucket
+ */
+static double hist_percentile(hist_t *h, int n, double q)
+{
+    unsigned long total = 0, rank, seen = 0;
+    double max = 0;
+    int i, b;
+
+    for (i = 0; i < n; i++) {
+        total += h[i].total;
+        max = (h[i].max > max) ? h[i].max : max;
+    }
+    rank = (unsigned long)(q * total);
+    rank = (rank < 1) ? 1 : rank;
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        for (i = 0; i < n; i++)
+            seen += h[i].count[b];
+        if (seen >= rank)
+            return (hist_hi(b) < max) ? hist_hi(b) : max;
     }
+    return max;
 }
 
-
 /*
- * calloc - you may want to look at mm-naive.c
+ * hist_lo, hist_hi - Return the smallest and largest sample a bucket holds
  */
-void *calloc (size_t nmemb, size_t size) {
-  size_t bytes = nmemb * size;
-  void *newptr;
+static unsigned long hist_lo(int bucket)
+{
+    int shift = bucket / HIST_SUB - 1;
+
+    if (shift < 0)
+        return bucket;
+    return (unsigned long)(bucket % HIST_SUB + HIST_SUB) << shift;
+}
 
-  newptr = malloc(bytes);
-  memset(newptr, 0, bytes);
+static unsigned long hist_hi(int bucket)
+{
+    int shift = bucket / HIST_SUB - 1;
 
-  return newptr;
+    if (shift < 0)
+        return bucket;
+    return hist_lo(bucket) + (1UL << shift) - 1;
 }
 
-// Returns 0 if no errors were found, otherwise returns the error
-int mm_checkheap(int verbose) {
-    
-    uint32_t *block = heap_listp;
-    int count_iter = 0;
-    int count_list = 0;
-    
-    //Check prologue blocks.
-    if (block_size(block) != 0) {
-        if (verbose)
-            printf("Pro block should be zero size, header = %x\n", block[0]);
-        return -1;         
-    }
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any libc malloc call fails.
+ *
+ */
+static int eval_libc_valid(trace_t *trace, int tracenum)
+{
+    int i, newsize;
+    char *p, *newp, *oldp;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+            if ((p = malloc(trace->ops[i].size)) == NULL &&
+                trace->ops[i].size != 0) {
+                malloc_error(trace_name(tracenum), i, "libc malloc failed");
+                unix_error("System message");
+            }
+            trace->blocks[trace->ops[i].index] = p;
+            break;
 
-    if(block_free(block)) {
-        if (verbose)
-            printf("Pro block should not be free, header = %x\n", block[0]);
-        return -1;
-    }       
+        case REALLOC: /* realloc */
+            newsize = trace->ops[i].size;
+            oldp = trace->blocks[trace->ops[i].index];
+            if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0) {
+                malloc_error(trace_name(tracenum), i, "libc realloc failed");
+                unix_error("System message");
+            }
+            trace->blocks[trace->ops[i].index] = newp;
+            break;
 
-    for (block = heap_listp + 2; block_size(block) > 0; block = block_next(block)) {
-        //printf("header = %x %d\n", block[0], block[0]);
-        //Check each block’s address alignment.
-        if (align(block + 1, 8) != block + 1) {
-            if (verbose)
-                printf("Block address alignment error\n");
-            return -1;
-        }
+        case FREE: /* free */
+            if (trace->ops[i].index == -1)
+                break;
+            free(trace->blocks[trace->ops[i].index]);
+            trace->blocks[trace->ops[i].index] = NULL;
+            break;
 
-        //Check heap boundaries.
-        if (!in_heap(block)) {
-            if (verbose)
-                printf("Block isn't in heap\n");
-            return -1;
-        }
-        
-        /* Check each block’s header and footer: 
-        size (minimum size, alignment), previous/next allocate/
-        free bit consistency, header and footer matching each other. */
-
-        unsigned int words = block_size(block);
-        if (words < 2) {
-            if (verbose)
-                printf("Block size is less then 8 bytes\n");
-            return -1;
-        }
-        if (words % 2 != 0) {
-            if (verbose)
-                printf("Header %x, size %d is not a multiples of 8 bytes\n",
-                      block[0],
-                      words);
-            return -1;
+        default:
+            app_error("invalid operation type  in eval_libc_valid");
         }
+    }
 
-        unsigned int next = block_size(block) + 1;        
-        if (block[next] != block[0]) {
-            if (verbose)
-                printf("Header and footer should be identical\n");
-            return -1;
-        }
+    /* Release anything the trace left allocated */
+    for (i = 0; i < trace->num_ids; i++) {
+        free(trace->blocks[i]);
+        trace->blocks[i] = NULL;
+    }
 
-        //Check coalescing: no two consecutive free blocks in the heap.
-        if (block_free(block)) {
-            count_iter++;
-            if (!in_list(block)) {
-                if (verbose)
-                    printf("This free block is in heap but not in list, size = %d\n",
-                           block_size(block));
-            }
+    return 1;
+}
 
+/*
+ * eval_libc_speed - This is the function that is used by fcyc() to
+ *    measure the running time of the libc malloc package on the set
+ *    of traces.
+ */
+static void eval_libc_speed(void *ptr)
+{
+    int i;
+    int index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+        case ALLOC: /* malloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = malloc(size)) == NULL && size != 0)
+                unix_error("malloc failed in eval_libc_speed");
+            trace->blocks[index] = p;
+            break;
 
+        case REALLOC: /* realloc */
+            index = trace->ops[i].index;
+            newsize = trace->ops[i].size;
+            oldp = trace->blocks[index];
+            if ((newp = realloc(oldp, newsize)) == NULL && newsize != 0)
+                unix_error("realloc failed in eval_libc_speed\n");
+            trace->blocks[index] = newp;
+            break;
 
-            if (block_free(block_prev(block)) || block_free(block_next(block))) {
-                if (verbose)
-                    printf("There should be no consecutive free blocks\n");
-                return -1;
-            }
+        case FREE: /* free */
+            index = trace->ops[i].index;
+            if (index == -1)
+                break;
+            block = trace->blocks[index];
+            free(block);
+            trace->blocks[index] = NULL;
+            break;
         }
     }
 
-    if (block_free(block)) {
-        if (verbose)
-            printf("Epi block should not be free\n");
-        return -1;
+    /* Release anything the trace left allocated */
+    for (i = 0; i < trace->num_ids; i++) {
+        free(trace->blocks[i]);
+        trace->blocks[i] = NULL;
     }
+}
 
-    for (int i = 0; i < SEG_LIST_SIZE; ++i) {        
-        if (seg_list[i] == NULL)
-            continue;
+/*************************************
+ * Some miscellaneous helper routines
+ ************************************/
 
-        for (block = seg_list[i]; block != NULL; block = block_succ(block)) {
-            count_list++;
-            
-            /*All next/previous pointers are consistent 
-             * (if A’s next pointer points to B, B’s previous pointer
-             * should point to A). */
-            uint32_t *pred = block_pred(block);
-            uint32_t *succ = block_succ(block);
-            if (pred != NULL) {
-                if (block != block_succ(pred)) {
-                    if (verbose)
-                        printf("List pointer is not consistent\n");
-                    return -1;
-                }
-            }
 
-            if (succ != NULL) {
-                if (block != block_pred(succ)) {
-                    if (verbose)
-                        printf("List pointer is not consistent\n");
-                    return -1;
-                }
-            }
+/*
+ * printperf - prints the hardware events per request of each trace,
+ *     and over all of them. Events that could not be counted show as -.
+ */
+static void printperf(int n, char **names, stats_t *stats,
+                      double (*counts)[PERF_EVENTS])
+{
+    int i, e;
+    double total[PERF_EVENTS];
+    double ops = 0;
+
+    printf("%-22s", "trace");
+    for (e = 0; e < PERF_EVENTS; e++) {
+        printf("%14s", perf_event_name(e));
+        total[e] = 0;
+    }
+    printf("\n");
 
-            //All free list pointers points between mem heap lo() and hi()
-            if (!in_heap(block)) {
-                if (verbose)
-                    printf("Block isn't in heap\n");
-                return -1;
-            }
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("%-22s", names[i]);
+        for (e = 0; e < PERF_EVENTS; e++) {
+            if (counts[i][e] < 0)
+                printf("%14s", "-");
+            else
+                printf("%14.2f", counts[i][e] / stats[i].ops);
+            total[e] += counts[i][e];
+        }
+        printf("\n");
+        ops += stats[i].ops;
+    }
+
+    printf("%-22s", "Total");
+    for (e = 0; e < PERF_EVENTS; e++) {
+        if (ops == 0 || counts[0][e] < 0)
+            printf("%14s", "-");
+        else
+            printf("%14.2f", total[e] / ops);
+    }
+    printf("\n");
+}
 
-            //All blocks in each list bucket fall within bucket size range
-            if (find_index(block_size(block)) != i) {
-                if (verbose)
-                    printf("Blocks size should fall within bucket size range\n");
-                return -1;                    
-            }            
+/*
+ * printresults - prints a performance summary for some malloc package
+ */
+static void printresults(int n, char **names, stats_t *stats)
+{
+    int i;
+    double secs = 0;
+    double ops = 0;
+    double util = 0;
+    double nodes = 0;
+    int show_nodes = 0; /* whether the package reports fit searches */
+
+    for (i=0; i < n; i++)
+        if (stats[i].valid && stats[i].nodes >= 0)
+            show_nodes = 1;
+
+    /* Print the individual results for each trace */
+    printf("%-22s%6s%8s%10s%11s%9s",
+           "trace", " valid", "util", "ops", "secs", "Kops");
+    printf(show_nodes ? "%8s\n" : "\n", "nodes");
+    for (i=0; i < n; i++) {
+        if (stats[i].valid) {
+            printf("%-22s%6s%7.1f%%%10.0f%11.6f%9.0f",
+                   names[i],
+                   "yes",
+                   stats[i].util*100.0,
+                   stats[i].ops,
+                   stats[i].secs,
+                   (stats[i].ops/1e3)/stats[i].secs);
+            printf(show_nodes ? "%8.2f\n" : "\n", stats[i].nodes);
+            secs += stats[i].secs;
+            ops += stats[i].ops;
+            util += stats[i].util;
+            nodes += stats[i].nodes;
+        }
+        else {
+            printf("%-22s%6s%8s%10s%11s%9s",
+                   names[i],
+                   "no",
+                   "-",
+                   "-",
+                   "-",
+                   "-");
+            printf(show_nodes ? "%8s\n" : "\n", "-");
         }
     }
 
-    /* Count free blocks by iterating through every block and 
-     * traversing free list by pointers and see if they match. */
-    //dbg_printf("Number of free blocks should be the same, "
-                   //"iter = %d, list = %d;\n", count_iter, count_list);
-    if (count_list != count_iter) {
-    //if (1) { 
-        if (verbose)
-            printf("Number of free blocks should be the same, "
-                   "iter = %d, list = %d;\n", count_iter, count_list);
-        return -1;                    
+    /* Print the aggregate results for the set of traces */
+    if (errors == 0) {
+        printf("%-22s%6s%7.1f%%%10.0f%11.6f%9.0f",
+               "Total       ",
+               "",
+               (util/n)*100.0,
+               ops,
+               secs,
+               (ops/1e3)/secs);
+        printf(show_nodes ? "%8.2f\n" : "\n", nodes/n);
     }
+    else {
+        printf("%-22s%6s%8s%10s%11s%9s",
+               "Total       ",
+               "-",
+               "-",
+               "-",
+               "-",
+               "-");
+        printf(show_nodes ? "%8s\n" : "\n", "-");
+    }
+
+}
+
+/*
+ * trace_name - Return the file name of trace number tracenum
+ */
+static char *trace_name(int tracenum)
+{
+    return tracenames[tracenum];
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    printf("%s\n", msg);
+    exit(1);
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
 
-    return 0;
+/*
+ * malloc_error - Report an error returned by the mm_malloc package
+ */
+static void malloc_error(char *name, int opnum, char *msg)
+{
+    errors++;
+    printf("ERROR [trace %s, line %d]: %s\n", name, LINENUM(opnum), msg);
 }
 
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mdriver [-hvVlDHPR] [-f <file>] [-t <dir>] "
+            "[-T <n>] [-m <mode>] [-C <file>] [-c <counter>]\n"
+            "               [-F <fit>] [-O <order>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-P         Count hardware events per request.\n");
+    fprintf(stderr, "\t-R         Report fragmentation at peak payload.\n");
+    fprintf(stderr, "\t-F <fit>   Fit policy: first, bestof:<n>, good or best (mm.c).\n");
+    fprintf(stderr, "\t-O <order> Free list order: lifo, fifo or addr (mm.c).\n");
+    fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
+    fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-D         Run the full mm_checkheap after every request.\n");
+    fprintf(stderr, "\t-T <n>     Also replay with 1 to <n> threads (mm.c only).\n");
+    fprintf(stderr, "\t-m <mode>  Threads split the ids, run a copy each, or free\n"
+            "\t           each other's blocks: split (default), copy, cross.\n");
+    fprintf(stderr, "\t-H         Print percentiles of the latency of each request.\n");
+    fprintf(stderr, "\t-C <file>  Same as -H, and write the histograms to <file>.\n");
+    fprintf(stderr, "\t-c <name>  Time with the rdtscp, rdtsc or clock counter\n"
+            "\t           (default rdtscp if the TSC is invariant, else clock).\n");
+}
@@ -2,7 +2,14 @@
  * memlib.c - a module that simulates the memory system.	Needed because it 
  *						allows us to interleave calls from the student's malloc package 
  *						with the system's malloc package in libc.
+ *						Besides the heap, it hands out and tracks page mappings
+ *						for blocks too large to keep in the heap, and lets the
+ *						allocator give unused pages back and count resident ones.
+ *						The heap is split into MEM_ARENAS arenas, each with
+ *						its own break, so that threads can grow separate
+ *						heaps without sharing one.
  */
+#define _GNU_SOURCE /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -16,10 +23,42 @@
 #include "memlib.h"
 #include "config.h"
 
+/* Start of arena i, each arena spanning MAX_HEAP bytes after the last */
+#define ARENA_LO(i)	(heap + (size_t)(i) * MAX_HEAP)
+#define HEAP_SPAN	((size_t)MEM_ARENAS * MAX_HEAP)
+
 /* private variables */
-static char *heap;
-static char *mem_brk;
-static char *mem_max_addr;
+static char *heap;						/* start of arena 0 */
+static char *arena_brk[MEM_ARENAS];
+static size_t heap_bytes;				/* bytes below the breaks of all arenas */
+
+/* Mappings made by mem_map, outside the heap */
+struct mapping {
+	char *addr;
+	size_t size;				/* bytes, a multiple of the page size */
+};
+static struct mapping *maps;
+static size_t num_maps, max_maps;
+static size_t mapped;			/* bytes in maps */
+static size_t peak;				/* most heap + mapped bytes since reset */
+static volatile int map_lock;	/* Guards maps and mapped */
+
+/* Advice mem_purge gives: MADV_DONTNEED drops the pages at once, so
+ * resident bytes fall as soon as they are purged. Build with
+ * -DMEM_PURGE_LAZY for MADV_FREE, cheaper to purge and to reuse, which
+ * leaves the pages resident until the system runs short of memory. */
+#ifdef MEM_PURGE_LAZY
+#define PURGE_ADVICE MADV_FREE
+#else
+#define PURGE_ADVICE MADV_DONTNEED
+#endif
+
+static struct mapping *find_mapping(const void *addr);
+static size_t resident(const char *lo, const char *hi);
+static void update_peak(void);
+static void unmap_all(void);
+static void lock_maps(void);
+static void unlock_maps(void);
 
 /* 
  * mem_init - initialize the memory system model
@@ -27,49 +66,270 @@ static char *mem_max_addr;
 void mem_init(void){
 	int dev_zero = open("/dev/zero", O_RDWR);
 	heap = mmap((void *)0x800000000, /* suggested start*/
-			MAX_HEAP,				/* length */
+			HEAP_SPAN,				/* length */
 			PROT_WRITE,				/* permissions */
-			MAP_PRIVATE,			/* private or shared? */
+			MAP_PRIVATE | MAP_NORESERVE, /* private, no swap reserved */
 			dev_zero,				/* fd */
 			0);						/* offset (dunno) */
-	mem_max_addr = heap + MAX_HEAP;
-	mem_brk = heap;					/* heap is empty initially */
+	close(dev_zero);
+	if (heap == MAP_FAILED) {
+		fprintf(stderr, "ERROR: mem_init failed to map %zu bytes\n",
+				HEAP_SPAN);
+		exit(1);
+	}
+	mem_reset_brk();				/* arenas are empty initially */
 }
 
 /* 
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void){
-	munmap(heap, MAX_HEAP);
+	munmap(heap, HEAP_SPAN);
+	unmap_all();
+	free(maps);
+	maps = NULL;
+	max_maps = 0;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointers to make every arena empty
  */
 void mem_reset_brk(){
-	mem_brk = heap;
+	for (int i = 0; i < MEM_ARENAS; i++)
+		arena_brk[i] = ARENA_LO(i);
+	heap_bytes = 0;
+	unmap_all();
+	peak = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *		by incr bytes and returns the start address of the new area. In
- *		this model, the heap cannot be shrunk.
+ *		by incr bytes and returns the start address of the new area.
+ *		A negative incr shrinks the heap, giving the whole pages past the
+ *		new break back to the system, and returns the old break.
+ *		The heap is arena 0.
  */
-void *mem_sbrk(int incr) {
-	char *old_brk = mem_brk;
+void *mem_sbrk(intptr_t incr) {
+	return mem_arena_sbrk(0, incr);
+}
+
+/*
+ * mem_arena_sbrk - mem_sbrk for the given arena. Calls for different
+ *		arenas may run at once; calls for one arena must not.
+ */
+void *mem_arena_sbrk(int arena, intptr_t incr) {
+	char *lo = ARENA_LO(arena);
+	char *old_brk = arena_brk[arena];
+	/* only arena 0 moves the real break: the process has just the one */
+	int real = arena == 0 && MAX_HEAP <= 0xffffffff;
+
+	if (incr < 0 && -incr <= old_brk - lo) {
+		arena_brk[arena] += incr;
+		__sync_fetch_and_add(&heap_bytes, incr);
+		mem_purge(arena_brk[arena], -incr);
+		if (real)
+			sbrk(incr);
+		return (void *)old_brk;
+	}
 
     // call sbrk() in an attempt to have similar semantics as a real allocator.
-	if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr) ||
-            sbrk(incr) == (void *) -1) {
+    // Heaps past 4 GiB skip it: the real break is never moved back, and a
+    // few traces would take it beyond what the system lets a process have.
+	if ( (incr < 0) || (incr > lo + MAX_HEAP - old_brk) ||
+            (real && sbrk(incr) == (void *) -1)) {
 		errno = ENOMEM;
 		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 		return (void *)-1;
 	}
 
-	mem_brk += incr;
+	arena_brk[arena] += incr;
+	__sync_fetch_and_add(&heap_bytes, incr);
+	update_peak();
 	return (void *)old_brk;
 }
 
+/*
+ * mem_arena_of - return the arena whose region holds p, or -1 if p is
+ *		outside every arena
+ */
+int mem_arena_of(const void *p) {
+	size_t offset = (size_t)((const char *)p - heap);
+
+	return offset < HEAP_SPAN ? (int)(offset / MAX_HEAP) : -1;
+}
+
+/*
+ * mem_arena_lo - return address of the first byte of the arena
+ */
+void *mem_arena_lo(int arena) {
+	return (void *)ARENA_LO(arena);
+}
+
+/*
+ * mem_arena_hi - return address of the last byte of the arena
+ */
+void *mem_arena_hi(int arena) {
+	return (void *)(arena_brk[arena] - 1);
+}
+
+/*
+ * mem_arena_size - return the arena size in bytes
+ */
+size_t mem_arena_size(int arena) {
+	return (size_t)(arena_brk[arena] - ARENA_LO(arena));
+}
+
+/*
+ * mem_purge - give the whole pages within the len bytes at addr back to
+ *		the system. Their contents are lost: they read as zeros once
+ *		touched again. Returns the number of bytes given back.
+ */
+size_t mem_purge(void *addr, size_t len) {
+	size_t page = mem_pagesize();
+	char *lo = (char *)(((size_t)addr + page - 1) & ~(page - 1));
+	char *hi = (char *)(((size_t)addr + len) & ~(page - 1));
+
+	if (hi <= lo || madvise(lo, hi - lo, PURGE_ADVICE) != 0)
+		return 0;
+	return hi - lo;
+}
+
+/*
+ * mem_resident - return how many bytes of the arenas and of the mappings
+ *		are resident in memory
+ */
+size_t mem_resident() {
+	size_t i, total = 0;
+
+	for (i = 0; i < MEM_ARENAS; i++)
+		total += resident(ARENA_LO(i), arena_brk[i]);
+	lock_maps();
+	for (i = 0; i < num_maps; i++)
+		total += resident(maps[i].addr, maps[i].addr + maps[i].size);
+	unlock_maps();
+	return total;
+}
+
+/*
+ * mem_map - map size bytes, rounded up to whole pages, outside the heap.
+ *		Returns the page-aligned start, or NULL with errno set on failure.
+ *		The mapping stays until mem_unmap or the next mem_reset_brk.
+ */
+void *mem_map(size_t size) {
+	struct mapping *m;
+	char *addr;
+
+	size = (size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		return NULL;
+
+	lock_maps();
+	if (num_maps == max_maps) {
+		m = realloc(maps, (max_maps ? 2 * max_maps : 16) * sizeof(*m));
+		if (m == NULL) {
+			unlock_maps();
+			munmap(addr, size);
+			errno = ENOMEM;
+			return NULL;
+		}
+		maps = m;
+		max_maps = max_maps ? 2 * max_maps : 16;
+	}
+	maps[num_maps].addr = addr;
+	maps[num_maps].size = size;
+	num_maps++;
+	mapped += size;
+	unlock_maps();
+	update_peak();
+	return addr;
+}
+
+/*
+ * mem_unmap - give the mapping starting at addr back to the system.
+ *		Returns 0, or -1 if addr does not start a mapping.
+ */
+int mem_unmap(void *addr) {
+	struct mapping *m;
+	size_t size;
+
+	lock_maps();
+	m = find_mapping(addr);
+	if (m == NULL || m->addr != addr) {
+		unlock_maps();
+		errno = EINVAL;
+		return -1;
+	}
+	size = m->size;
+	mapped -= size;
+	*m = maps[--num_maps];
+	unlock_maps();
+	munmap(addr, size);
+	return 0;
+}
+
+/*
+ * mem_remap - resize the mapping starting at addr to size bytes, rounded
+ *		up to whole pages, moving it if it cannot grow where it is. The
+ *		contents are kept without copying. Returns the new start, or NULL
+ *		with the mapping untouched on failure.
+ */
+void *mem_remap(void *addr, size_t size) {
+	struct mapping *m;
+	char *new_addr;
+
+	lock_maps();
+	m = find_mapping(addr);
+	if (m == NULL || m->addr != addr) {
+		unlock_maps();
+		errno = EINVAL;
+		return NULL;
+	}
+	size = (size + mem_pagesize() - 1) & ~(mem_pagesize() - 1);
+	new_addr = mremap(m->addr, m->size, size, MREMAP_MAYMOVE);
+	if (new_addr == MAP_FAILED) {
+		unlock_maps();
+		return NULL;
+	}
+
+	mapped = mapped - m->size + size;
+	m->addr = new_addr;
+	m->size = size;
+	unlock_maps();
+	update_peak();
+	return new_addr;
+}
+
+/*
+ * mem_in_map - return whether the size bytes at lo lie in one mapping
+ */
+int mem_in_map(const void *lo, size_t size) {
+	struct mapping *m;
+	int in;
+
+	lock_maps();
+	m = find_mapping(lo);
+	in = m != NULL && (size_t)((const char *)lo - m->addr) + size <= m->size;
+	unlock_maps();
+	return in;
+}
+
+/*
+ * mem_mapsize - return the bytes currently mapped outside the heap
+ */
+size_t mem_mapsize() {
+	return mapped;
+}
+
+/*
+ * mem_peaksize - return the most heap plus mapped bytes in use at once
+ *		since the last mem_reset_brk
+ */
+size_t mem_peaksize() {
+	return peak;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -81,14 +341,14 @@ void *mem_heap_lo(){
  * mem_heap_hi - return address of last heap byte
  */
 void *mem_heap_hi(){
-	return (void *)(mem_brk - 1);
+	return (void *)(arena_brk[0] - 1);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, summed over the arenas
  */
 size_t mem_heapsize() {
-	return (size_t)((void *)mem_brk - (void *)heap);
+	return heap_bytes;
 }
 
 /*
@@ -97,3 +357,77 @@ size_t mem_heapsize() {
 size_t mem_pagesize(){
 	return (size_t)getpagesize();
 }
+
+/*
+ * find_mapping - return the mapping holding addr, or NULL
+ */
+static struct mapping *find_mapping(const void *addr) {
+	size_t i;
+
+	for (i = 0; i < num_maps; i++) {
+		if ((const char *)addr >= maps[i].addr &&
+				(const char *)addr < maps[i].addr + maps[i].size)
+			return &maps[i];
+	}
+	return NULL;
+}
+
+/*
+ * update_peak - fold the current heap plus mapped bytes into the peak
+ */
+static void update_peak(void) {
+	size_t total = heap_bytes + mapped;
+	size_t old;
+
+	while ((old = peak) < total &&
+			!__sync_bool_compare_and_swap(&peak, old, total))
+		;
+}
+
+/*
+ * unmap_all - give every mapping back to the system. Only called while
+ *		no thread is allocating.
+ */
+static void unmap_all(void) {
+	while (num_maps > 0) {
+		num_maps--;
+		munmap(maps[num_maps].addr, maps[num_maps].size);
+	}
+	mapped = 0;
+}
+
+/*
+ * resident - return how many bytes of the pages covering [lo, hi) are
+ *		resident in memory, asking mincore a batch of pages at a time
+ */
+static size_t resident(const char *lo, const char *hi) {
+	size_t page = mem_pagesize();
+	unsigned char vec[256];
+	size_t i, n, total = 0;
+
+	lo = (const char *)((size_t)lo & ~(page - 1));
+	while (lo < hi) {
+		n = ((size_t)(hi - lo) + page - 1) / page;
+		if (n > sizeof(vec))
+			n = sizeof(vec);
+		if (mincore((void *)lo, n * page, vec) != 0)
+			break;
+		for (i = 0; i < n; i++)
+			total += (vec[i] & 1) * page;
+		lo += n * page;
+	}
+	return total;
+}
+
+/*
+ * lock_maps, unlock_maps - spin lock around the mapping table
+ */
+static void lock_maps(void) {
+	while (__sync_lock_test_and_set(&map_lock, 1))
+		while (map_lock)
+			;
+}
+
+static void unlock_maps(void) {
+	__sync_lock_release(&map_lock);
+}
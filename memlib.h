@@ -1,11 +1,25 @@
+#include <stdint.h>
 #include <unistd.h>
 
 void mem_init(void);               
 void mem_deinit(void);
-void *mem_sbrk(int incr);
+void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+void *mem_map(size_t size);
+int mem_unmap(void *addr);
+void *mem_remap(void *addr, size_t size);
+int mem_in_map(const void *lo, size_t size);
+size_t mem_mapsize(void);
+size_t mem_peaksize(void);
+size_t mem_purge(void *addr, size_t len);
+size_t mem_resident(void);
+int mem_arena_of(const void *p);
+void *mem_arena_sbrk(int arena, intptr_t incr);
+void *mem_arena_lo(int arena);
+void *mem_arena_hi(int arena);
+size_t mem_arena_size(int arena);
 
@@ -16,6 +16,37 @@
  * By printing out the required block size, I arranged segregated list with
  * size of 3 * DSIZE, 6 * DSIZE, 9 * DSIZE(bytes) and so on. It becomes 
  * sparse as the block size increasing. 
+ * In front of the segregated list sits a per-thread cache: freed blocks of
+ * the small seg classes are kept, still marked allocated, on a bounded
+ * LIFO stack per class, and malloc pops from it without touching any
+ * shared state. Blocks move between the thread caches and the seg lists
+ * in batches, under the lock of the thread's arena, and a thread's whole
+ * cache goes back when the thread exits.
+ * Blocks that realloc keeps growing count their growth in two spare
+ * header bits and, when they have to move from the second growth on,
+ * get half their size again as headroom; the footer of such a block
+ * records the size in use. The
+ * headroom goes back on a real shrink, or when the heap cannot grow.
+ * Requests of up to SLAB_MAX bytes skip boundary tags altogether: they
+ * are carved from 1 KiB runs, one size class per run, each run an
+ * ordinary allocated block whose payload is aligned so that masking an
+ * object's address gives the run's metadata. Objects carry no header;
+ * a bitmap of the heap's run slots tells free which pointers are in a run.
+ * Requests of MMAP_THRESHOLD bytes or more bypass the heap: each gets a
+ * mapping of its own that free gives back to the system, and realloc
+ * resizes it by remapping rather than copying.
+ * Memory freed after a spike does not stay resident: the whole pages
+ * inside large free blocks are purged once they have stayed free for a
+ * while, and a large free block at the end of the heap is cut back by
+ * shrinking the heap. mm_trim does both at once.
+ * The heap is really MEM_ARENAS heaps, one per memlib arena, each with
+ * its own seg lists, runs and lock. A thread takes its blocks from the
+ * arena it is given on first use, round-robin or, built with
+ * -DARENA_BY_CPU, by the CPU it runs on; free finds a block's arena from
+ * its address, so any thread may free any block. A block freed by a
+ * thread of another arena is pushed, without a lock, on that arena's
+ * remote queue, and the arena's next locked malloc frees the whole queue
+ * at once, so that the owner still does the coalescing.
  * mm_checkheap and other related functions are used to debug the malloc.
  * It checks the performance of the blocks. More specific explanation is
  * in the header of mm_checkheap function.
@@ -28,14 +59,21 @@
  *                             [Footer: size, 0]
  */
 
+#define _GNU_SOURCE /* sched_getcpu */
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "config.h"
+#include "sizeclass.h"
 
 /* If you want debugging output, use the following macro.  When you hand
  * in, remove the #define DEBUG line. */
@@ -62,28 +100,53 @@
 /* rounds up to the nearest multiple of ALIGNMENT */
 #define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~0x7)
 
-/* Basic constants and macros */
+/* Header and footer words. 32-bit words keep blocks small but limit
+ * a block, and so the heap, to 4 GiB. Build with -DWIDE_HEADERS for
+ * 64-bit words, which a MAX_HEAP above 4 GiB requires.
+ */
+#ifdef WIDE_HEADERS
+typedef unsigned long word_t;
+#define WSIZE       8       /* Word and header/footer size (bytes) */
+#else
+typedef unsigned int word_t;
 #define WSIZE       4       /* Word and header/footer size (bytes) */
-#define DSIZE       8       /* Double word size (bytes) */
+#if MAX_HEAP > 0xffffffff
+#error "MAX_HEAP above 4 GiB needs -DWIDE_HEADERS"
+#endif
+#endif
+
+/* Basic constants and macros */
+#define DSIZE       (2 * WSIZE)	/* Double word size (bytes) */
 #define CHUNKSIZE   168		/* Extend heap by this amount (bytes) */
-#define MINIMUM		24		/* Minimum block size head + foot = 8, 
-                               prev + next = 16. Total 24(bytes).*/
+#define MINIMUM		(DSIZE + 2 * (int)sizeof(void *))	/* Minimum block size
+                               head + foot = 8, prev + next = 16.
+                               Total 24(bytes), 32 with wide words.*/
+#define MAX_BLOCK	((size_t)(word_t)~0x7)	/* Largest size a header holds */
+#define MAX_REQUEST	(MAX_BLOCK - DSIZE - ALIGNMENT)	/* Largest payload */
 
 
 /*** Macros ***/
 #define MAX(x, y) ((x) > (y)? (x) : (y))
+#define MIN(x, y) ((x) < (y)? (x) : (y))
 
 /* Pack a size and allocated bit into a word */
 #define PACK(size, alloc)  ((size) | (alloc))
 
 /* Read and write a word at address p */
-#define GET(p)       (*(unsigned int *)(p))
-#define PUT(p, val)  (*(unsigned int *)(p) = (val))
+#define GET(p)       (*(word_t *)(p))
+#define PUT(p, val)  (*(word_t *)(p) = (val))
 
 /* Read the size and allocated fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
 
+/* Growth count of an allocated block, bits 1-2 of its header.
+ * While it is non-zero the footer holds the size in use instead of
+ * the block size. */
+#define GROWTH_SHIFT	1
+#define GROWTH_MAX		3
+#define GET_GROWTH(p)	((GET(p) >> GROWTH_SHIFT) & GROWTH_MAX)
+
 /* Given block ptr bp,compute address of its header and footer */
 #define HDRP(bp) ((void *)(bp) - WSIZE)
 #define FTRP(bp) ((void *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
@@ -93,7 +156,7 @@
 #define PREV_BLKP(bp) ((void *)(bp) - GET_SIZE(HDRP(bp) - WSIZE))
 
 /* Given block ptr bp, compute address of next and previous free blocks */
-#define NEXT_FRPT(bp) (*(void **)(bp + DSIZE))
+#define NEXT_FRPT(bp) (*(void **)(bp + sizeof(void *)))
 #define PREV_FRPT(bp) (*(void **)(bp))
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
@@ -101,152 +164,570 @@
 
 /* Get the enrty pointer in seg list, also define seg length*/
 #define SEG_ENTRY(seg_list, i)		(*(void **)(seg_list + i * DSIZE))
-#define SEG_NUM		14
+#define SEG_NUM		((int)(sizeof(seg_bounds) / sizeof(seg_bounds[0])) + 1)
 /*** Macros End ***/
 
-/* Seg number, bsaed on minimum size of blocks and distribution
+/* Seg bounds, bsaed on minimum size of blocks and distribution
  * of sizes appear in the program. For example, 3 represents 3 * 
- * DSIZE of a block, which is equal to MINIMUM.
- */
-#define SIZE0	3
-#define SIZE1	6
-#define SIZE2	9
-#define SIZE3	12
-#define SIZE4	15
-#define SIZE5	30
-#define SIZE6	60
-#define SIZE7	120
-#define SIZE8	240
-#define SIZE9	480
-#define SIZE10	960
-#define SIZE11	1920
-#define SIZE12	3840
+ * DSIZE of a block, which is equal to MINIMUM. Entry i holds blocks
+ * up to the i-th bound, the last entry everything larger. Override
+ * with -DSEG_BOUNDS=... at build time.
+ */
+#ifndef SEG_BOUNDS
+#define SEG_BOUNDS	3, 6, 9, 12, 15, 30, 60, 120, 240, 480, 960, 1920, 3840
+#endif
+static const size_t seg_bounds[] = { SEG_BOUNDS };
+
+/* Fit policies for find_fit. Pick one at build time with e.g.
+ * -DFIT_POLICY=FIT_BEST_OF -DFIT_BEST_N=16, or at run time with
+ * mm_fit_policy:
+ *   FIT_FIRST    first block that fits
+ *   FIT_BEST_OF  smallest of the first FIT_BEST_N blocks that fit
+ *   FIT_GOOD     in the request's own seg, the first block within
+ *                1/GOOD_SLACK of the request, else the smallest there;
+ *                above it, the first block, as first fit
+ *   FIT_BEST     smallest block that fits
+ * A seg holds only blocks larger than any in the segs below it, so
+ * every policy stops at the first seg that has a fit.
+ */
+enum fit_policy {FIT_FIRST, FIT_BEST_OF, FIT_GOOD, FIT_BEST};
+#ifndef FIT_POLICY
+#define FIT_POLICY	FIT_FIRST
+#endif
+#ifndef FIT_BEST_N
+#define FIT_BEST_N	8
+#endif
+#define GOOD_SLACK	8
+
+/* Free list orders, where add_block puts a block in its seg list:
+ *   ORDER_LIFO  at the head
+ *   ORDER_FIFO  at the tail
+ *   ORDER_ADDR  in address order, so a first fit is the lowest fit
+ * Address order finds a block's place from an index of each seg: a
+ * bitmap of the arena's ADDR_SPAN-byte spans that hold a block of the
+ * seg, and the lowest such block of each span. An insert then steps
+ * over the seg's blocks in one span at most, not the whole list. The
+ * index is mapped by the first mm_init that uses address order, so the
+ * other orders do not pay for it. Pick one at build time with e.g.
+ * -DFREE_ORDER=ORDER_ADDR, or with mm_free_order before mm_init.
+ */
+enum free_order {ORDER_LIFO, ORDER_FIFO, ORDER_ADDR};
+#ifndef FREE_ORDER
+#define FREE_ORDER	ORDER_LIFO
+#endif
+#ifndef ADDR_SHIFT
+#if MAX_HEAP > (1L << 28)
+#define ADDR_SHIFT	20
+#else
+#define ADDR_SHIFT	12
+#endif
+#endif
+#define ADDR_SPAN	(1UL << ADDR_SHIFT)	/* bytes */
+#define ADDR_SPANS	((size_t)MAX_HEAP / ADDR_SPAN + 1)
+#define ADDR_WORDS	(ADDR_SPANS / (8 * sizeof(long)) + 1)
+#define ADDR_SPAN_OF(a, bp)	((size_t)((char *)(bp) - (a)->lo) >> ADDR_SHIFT)
+
+/* Realloc headroom. A block that moves when growing for the
+ * HEADROOM_MIN-th time or later is given HEADROOM(asize) spare bytes,
+ * so the copies of a block that keeps growing are amortized. Build with
+ * -DREALLOC_HEADROOM=0 to turn it off.
+ */
+#ifndef REALLOC_HEADROOM
+#define REALLOC_HEADROOM	1
+#endif
+#define HEADROOM_MIN	2
+#define HEADROOM(asize)	(REALLOC_HEADROOM ? ALIGN((asize) / 2) : 0)
+
+/* Thread cache. Classes 0..TCACHE_CLASSES-1 of the seg list are cached,
+ * which covers blocks up to 15 * DSIZE bytes with the default bounds. Cached blocks keep their
+ * allocated bit and link through the first word of their payload.
+ */
+#define TCACHE_CLASSES	5		/* Seg classes served by the cache */
+#define TCACHE_MAX		(seg_bounds[TCACHE_CLASSES - 1] * DSIZE) /* bytes */
+#define TCACHE_COUNT	7		/* Blocks held per class */
+#define TCACHE_BATCH	4		/* Blocks moved per flush or refill */
+#define TCACHE_NEXT(bp)	(*(void **)(bp))
+
+/* Remote queue links, through the first word of the payload like the
+ * thread cache */
+#define REMOTE_NEXT(bp)	(*(void **)(bp))
+
+/* Slab runs. A run is an allocated block of RUN_SIZE bytes whose payload
+ * starts RUN_OFFSET bytes into a RUN_SIZE-aligned slot, with the run
+ * header first and then equal objects of one class. Classes are every
+ * multiple of ALIGNMENT up to SLAB_MAX. Small heaps stay on the seg
+ * lists, where a mostly empty run would cost more than it saves.
+ */
+#define RUN_SHIFT		10
+#define RUN_SIZE		(1UL << RUN_SHIFT)	/* bytes */
+#define RUN_OFFSET		DSIZE		/* payload offset of a run in its slot */
+#define RUN_OF(p)		((struct slab_run *) \
+	((((size_t)(p)) & ~(RUN_SIZE - 1)) + RUN_OFFSET))
+#define SLAB_MAX		64			/* Largest request served by runs */
+#define SLAB_CLASSES	(SLAB_MAX / ALIGNMENT)
+#define SLAB_CLASS(size) (((size) - 1) / ALIGNMENT)
+#define SLAB_MIN_HEAP	(32 * 1024)	/* Heap size before runs are used */
+#define RUN_MAP_WORDS	(MAX_HEAP / RUN_SIZE / (8 * sizeof(long)) + 1)
+
+/* Huge blocks. A huge block is a mapping from mem_map that starts with
+ * a struct huge_block, the payload following at HUGE_OFFSET. Its
+ * address, outside every arena, tells it apart from other blocks; the list
+ * of huge blocks is kept for mm_checkheap. Override the threshold with
+ * -DMMAP_THRESHOLD=... at build time.
+ */
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD	(512 * 1024)	/* Smallest request mapped (bytes) */
+#endif
+#define HUGE_OFFSET		ALIGN(sizeof(struct huge_block))
+#define HUGE_OF(p)		((struct huge_block *)((char *)(p) - HUGE_OFFSET))
+#define IS_HUGE(p)		(mem_arena_of(p) < 0)
+#define ARENA_OF(p)		(&arenas[mem_arena_of(p)])	/* of a heap block */
+
+/* Purging. Free blocks of PURGE_MIN bytes or more are stamped with the
+ * purge epoch when they join a seg list. Once every PURGE_DECAY_MS, as
+ * checked every PURGE_CHECK heap frees, a sweep starts a new epoch: it
+ * cuts a free block of TRIM_THRESHOLD bytes or more ending the heap back
+ * to TRIM_PAD by shrinking the heap, and purges the blocks stamped before
+ * the previous sweep. So pages left free for one to two periods go back
+ * to the system, while pages reused sooner are never purged and faulted
+ * back in. Build with -DPURGE_DECAY_MS=0 to purge only in mm_trim.
+ */
+#ifndef PURGE_DECAY_MS
+#define PURGE_DECAY_MS	1000
+#endif
+#define PURGE_CHECK		256			/* Heap frees between clock reads */
+#define PURGE_MIN		(16 * 1024)	/* Smallest free block purged (bytes) */
+#define PURGED			(~0UL)		/* Stamp of a block already purged */
+#define PURGE_STAMP(bp)	(*(unsigned long *)((char *)(bp) + 2 * sizeof(void *)))
+#define TRIM_THRESHOLD	(256 * 1024)	/* bytes */
+#define TRIM_PAD		(64 * 1024)		/* bytes */
+
+/* Size tree. The blocks of the top seg, every one PURGE_MIN bytes or
+ * more, are also kept in a bitwise trie on their size, so that find_fit
+ * takes the best of them in O(log n) instead of walking the list. There
+ * is one trie per power of two, like dlmalloc's tree bins; in the trie
+ * of 2^k, the children of a node at depth d differ in bit k-1-d of
+ * their size. A node heads a ring of the blocks of its size; the others
+ * in the ring hang off it with TREE_RING for parent. The node sits in
+ * the payload, past the links and purge stamp. Build with -DFREE_TREE=0
+ * to search the top seg as a list.
+ */
+#ifndef FREE_TREE
+#define FREE_TREE		1
+#endif
+#define TREE_SEG		(SEG_NUM - 1)	/* Seg whose blocks are in the tree */
+#define TREE_BINS		(8 * sizeof(size_t))
+#define TREE_RING		((void *)-1)
+#define TREE_NODE(bp)	((void **)(&PURGE_STAMP(bp) + 1))
+#define TREE_CHILD(bp, i)	(TREE_NODE(bp)[i])
+#define TREE_PARENT(bp)	(TREE_NODE(bp)[2])	/* NULL at the root */
+#define TREE_NEXT(bp)	(TREE_NODE(bp)[3])
+#define TREE_PREV(bp)	(TREE_NODE(bp)[4])
+#define TREE_END(bp)	((char *)(TREE_NODE(bp) + 5))
+
+/* Deferred coalescing. Built with -DDEFER_COALESCE=1, heap_free puts a
+ * block of up to QUICK_MAX bytes, still marked allocated, on the quick
+ * list of its exact size instead of coalescing it, and heap_malloc hands
+ * it out again as it is, with no search and no split. The quick lists
+ * are swept, every block freed and coalesced for real, when they hold
+ * more than QUICK_BUDGET bytes, when a fit search fails, and in mm_trim.
+ */
+#ifndef DEFER_COALESCE
+#define DEFER_COALESCE	0
+#endif
+#define QUICK_MAX		512				/* bytes, below RUN_SIZE */
+#define QUICK_LISTS		(QUICK_MAX / ALIGNMENT + 1)
+#define QUICK_BUDGET	(64 * 1024)		/* bytes */
+#define QUICK_NEXT(bp)	(*(void **)(bp))
+
+struct huge_block {
+	struct huge_block *next;
+	struct huge_block *prev;
+	size_t size;				/* Bytes mapped, whole pages */
+};
+
+struct slab_run {
+	struct slab_run *next;		/* Partial runs of the class */
+	struct slab_run *prev;
+	void *free;					/* Freed objects, linked through word 0 */
+	unsigned int bump;			/* Offset of the first never-used object */
+	unsigned short used;		/* Objects handed out */
+	unsigned short class;
+};
+
+struct tcache {
+	unsigned int gen;			/* heap_gen the entries belong to */
+	unsigned int count[TCACHE_CLASSES];
+	void *entry[TCACHE_CLASSES];
+	struct mm_tcache_stats stats;
+};
+
+/* An arena: one memlib arena and the free lists, slab runs and purge
+ * state of the heap in it, all guarded by its lock */
+struct arena {
+	volatile int lock;
+	int index;					/* memlib arena number */
+	char *lo;					/* First byte of the arena */
+	char *seg_list;				/* Pointer to first seg */
+	char *heap_listp;			/* NULL until the heap is set up */
+	unsigned long seg_map;		/* Bit i set iff seg entry i is non-empty;
+								   SEG_NUM <= SC_MAX_CLASSES fits a word */
+	struct slab_run *slab_partial[SLAB_CLASSES];	/* Partial runs per class */
+	unsigned long run_map[RUN_MAP_WORDS];	/* Bit per RUN_SIZE slot, set iff a run */
+	unsigned long purge_epoch;
+	unsigned int purge_ticks;	/* Heap frees since the last clock read */
+	unsigned long purge_last;	/* Time of the last sweep in ms */
+	void *volatile remote;		/* Blocks freed by other arenas' threads,
+								   pushed without the lock */
+	void *seg_tail[SEG_NUM];	/* Last block of each seg list */
+	size_t addr_words;			/* Words of addr_map ever set */
+	void *tree[TREE_BINS];		/* Size tree of each power of two */
+	unsigned long tree_map;		/* Bit k set iff tree[k] is non-empty */
+	void *quick[QUICK_LISTS];	/* Deferred blocks of each size / ALIGNMENT */
+	size_t quick_bytes;			/* Their total size */
+	struct mm_coalesce_stats coal;	/* Merges, splits and deferred frees */
+	struct mm_fit_stats fit;	/* find_fit calls and free blocks visited */
+};
 
 /*** Declaration ***/
-static void *coalesce(void *ptr);
-static void *extend_heap(size_t words);
-static void *find_fit(size_t size);
-static void place(void *bp, size_t size);
-static void delete_block(void *bp);
-static void *add_block(void *bp);
+static void *heap_malloc(struct arena *a, size_t asize);
+static void heap_free(struct arena *a, void *ptr);
+static int arena_init(struct arena *a);
+static int addr_index_map(void);
+static struct arena *thread_arena(void);
+static void spin_lock(volatile int *lock);
+static void spin_unlock(volatile int *lock);
+static void tcache_check(void);
+static void tcache_flush(struct arena *a, unsigned int class, unsigned int n);
+static void tcache_refill(struct arena *a, unsigned int class, size_t asize);
+static void tcache_key_init(void);
+static void tcache_exit(void *arena);
+static void remote_free(struct arena *a, void *ptr);
+static void remote_drain(struct arena *a);
+static void *coalesce(struct arena *a, void *ptr);
+static void *extend_heap(struct arena *a, size_t words);
+static void *find_fit(struct arena *a, size_t size);
+static void place(struct arena *a, void *bp, size_t size);
+static void delete_block(struct arena *a, void *bp);
+static void *add_block(struct arena *a, void *bp);
+static void link_block(struct arena *a, void *bp, unsigned int seg,
+	void *prev);
+static void *addr_prev(struct arena *a, void *bp, unsigned int seg);
+static void tree_insert(struct arena *a, void *bp);
+static void tree_remove(struct arena *a, void *bp);
+static void *tree_fit(struct arena *a, size_t size);
+static void quick_sweep(struct arena *a);
+static void *grow_block(struct arena *a, void *ptr, size_t asize);
+static void set_growth(void *bp, unsigned int growth, size_t used);
+static size_t trim_headroom(struct arena *a);
 static unsigned int get_list_number(size_t size);
-static void check_block(void *bp);
+static void *slab_malloc(struct arena *a, unsigned int class);
+static void slab_free(struct arena *a, struct slab_run *run, void *ptr);
+static void release_run(struct arena *a, struct slab_run *run);
+static struct slab_run *slab_run_of(struct arena *a, const void *ptr);
+static struct slab_run *new_run(struct arena *a, unsigned int class);
+static void *carve_run(struct arena *a, void *bp);
+static void *run_fit(struct arena *a);
+static void *huge_malloc(size_t size);
+static void huge_free(void *ptr);
+static void *huge_realloc(void *ptr, size_t size);
+static void huge_link(struct huge_block *hb);
+static void huge_unlink(struct huge_block *hb);
+static size_t purge_free(struct arena *a, unsigned long before);
+static size_t trim_tail(struct arena *a, size_t pad);
+static void purge_decay(struct arena *a);
+static void check_arena(struct arena *a, int lineno);
+static void check_block(struct arena *a, void *bp);
 static void print_block(void *bp);
-static void check_free();
-static int in_heap(const void *p);
+static void check_free(struct arena *a);
+static long check_tree(void *t, void *parent, size_t prefix,
+	unsigned int shift);
+static void check_runs(struct arena *a);
+static void check_quick(struct arena *a);
+static void check_huge(void);
+static int in_heap(struct arena *a, const void *p);
 static int aligned(const void *p);
 /*** Declaration End ***/
 
-/* Global Variables: seg_list, heap_listp */
-static char *seg_list = 0; /* Pointer to first seg */
-static char *heap_listp = 0;
+/* Global Variables: arenas, huge list */
+const int mm_thread_safe = 1;	/* Arenas and huge list are locked */
+static struct arena arenas[MEM_ARENAS];
+static volatile unsigned int next_arena = 0; /* Round-robin arena choice */
+static struct size_classes seg_classes; /* Lookup tables for seg_bounds */
+static volatile unsigned int heap_gen = 0; /* Bumped by every mm_init */
+static struct mm_realloc_stats realloc_stats; /* Updated without the lock,
+												 so approximate under threads */
+static struct mm_remote_stats remote_stats; /* Updated atomically */
+static struct mm_fit_stats fit_stats;	/* Of arenas since reset by mm_init */
+static struct mm_coalesce_stats coalesce_stats;	/* Likewise */
+static enum fit_policy fit_policy = FIT_POLICY;
+static unsigned int fit_best_n = FIT_BEST_N;
+static enum free_order free_order = FREE_ORDER;
+static enum free_order next_order = FREE_ORDER; /* Set by mm_free_order */
+/* Address order index of each arena's segs, see ORDER_ADDR, indexed
+ * [arena][seg][...]. NULL until an mm_init first needs it. */
+static unsigned long (*addr_map)[SEG_NUM][ADDR_WORDS];
+static void *(*addr_first)[SEG_NUM][ADDR_SPANS];
+
+/* Huge blocks, mapped outside the heap */
+static struct huge_block *huge_list = NULL;
+static volatile int huge_lock = 0; /* Guards huge_list */
+
+/* Per-thread cache of small freed blocks of the thread's arena */
+static __thread struct tcache tcache;
+static __thread struct arena *my_arena;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key; /* Its destructor flushes the cache */
 
 
 /* Malloc Routine: init, malloc, free, realloc, calloc */
 /* 
  * mm_init
  * Initialize: return -1 on error, 0 on success.
- * Initialize segregated list first. Set every entry in segeregated list 
- * point to NULL.
- * Then set prologue header, footer and Epilogue head for the heap.
+ * Forget every arena's heap, and set up the heap of arena 0 at once.
+ * The other arenas set theirs up when a thread first mallocs from them.
  */
 int mm_init(void) {
-	/* Initialize seg list frist */
-	if ((seg_list = mem_sbrk(SEG_NUM * DSIZE)) == NULL){
+	sizeclass_init(&seg_classes, seg_bounds, SEG_NUM - 1);
+	/* The tree node of a top seg block lies past its purge stamp */
+	assert(seg_bounds[TREE_SEG - 1] * DSIZE >= PURGE_MIN);
+
+	for (int i = 0; i < MEM_ARENAS; i++){
+		fit_stats.searches += arenas[i].fit.searches;
+		fit_stats.nodes += arenas[i].fit.nodes;
+		fit_stats.inserts += arenas[i].fit.inserts;
+		fit_stats.steps += arenas[i].fit.steps;
+		coalesce_stats.merges += arenas[i].coal.merges;
+		coalesce_stats.splits += arenas[i].coal.splits;
+		coalesce_stats.deferred += arenas[i].coal.deferred;
+		coalesce_stats.reused += arenas[i].coal.reused;
+		coalesce_stats.sweeps += arenas[i].coal.sweeps;
+		for (int j = 0; addr_map != NULL && j < SEG_NUM; j++){
+			memset(addr_map[i][j], 0, arenas[i].addr_words * sizeof(long));
+		}
+		memset(&arenas[i], 0, sizeof(arenas[i]));
+		arenas[i].index = i;
+		arenas[i].lo = mem_arena_lo(i);
+	}
+	huge_list = NULL; /* mem_reset_brk unmapped any left over */
+	free_order = next_order;
+	if (free_order == ORDER_ADDR && addr_map == NULL && addr_index_map() < 0){
 		return -1;
 	}
 
+	/* Any cached block belongs to the old heap */
+	heap_gen++;
+
+	return arena_init(&arenas[0]);
+}
+
+/*
+ * arena_init
+ * para: an arena. Return -1 on error, 0 on success.
+ * Unless another thread got there first, set up the arena's heap:
+ * initialize segregated list first, setting every entry to NULL, then
+ * set prologue header, footer and Epilogue head for the heap.
+ */
+static int arena_init(struct arena *a)
+{
+	int ret = 0;
+
+	spin_lock(&a->lock);
+	if (a->heap_listp != NULL){
+		spin_unlock(&a->lock);
+		return 0;
+	}
+
+	/* Initialize seg list frist */
+	if ((a->seg_list = mem_arena_sbrk(a->index, SEG_NUM * DSIZE)) ==
+		(void *)-1){
+		ret = -1;
+		goto out;
+	}
 	for (int i = 0; i < SEG_NUM; i++){
-		SEG_ENTRY(seg_list, i) = NULL;
+		SEG_ENTRY(a->seg_list, i) = NULL;
 	}
 
 	/* Create the initial empty heap */
-	if ((heap_listp = mem_sbrk(4 * WSIZE)) == NULL){
-		return -1;
+	if ((a->heap_listp = mem_arena_sbrk(a->index, 4 * WSIZE)) == (void *)-1){
+		a->heap_listp = NULL;
+		ret = -1;
+		goto out;
 	}
-	PUT(heap_listp, 0);
-	PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */
-	PUT(heap_listp + (DSIZE), PACK(DSIZE, 1)); /* Prologue footer */
-	PUT(heap_listp + (3*WSIZE), PACK(0, 1)); /*Epilogue head */
+	PUT(a->heap_listp, 0);
+	PUT(a->heap_listp + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */
+	PUT(a->heap_listp + (DSIZE), PACK(DSIZE, 1)); /* Prologue footer */
+	PUT(a->heap_listp + (3*WSIZE), PACK(0, 1)); /*Epilogue head */
 
-	heap_listp += (DSIZE);
+	a->heap_listp += (DSIZE);
 
 	/* Extend the empty heap with a free block of CHUNKSIZE bytes */
-	if (extend_heap(CHUNKSIZE/WSIZE) == NULL){
-		return -1;
+	if (extend_heap(a, CHUNKSIZE/WSIZE) == NULL){
+		ret = -1;
 	}
-    return 0;
+out:
+	spin_unlock(&a->lock);
+	return ret;
 }
 
 
 /*
  * malloc
  * First align block size. Each block must has at least 24 bytes.
- * Find if there is a free block for current requirement.
- * If can't find a suitable block, extende the heap.
+ * Requests of MMAP_THRESHOLD or more are mapped on their own.
+ * Everything else comes from the calling thread's arena, which first
+ * frees the blocks other threads queued for it whenever it is locked.
+ * Requests up to SLAB_MAX come from a slab run once the arena is big
+ * enough. Small requests are served from the thread cache when its top
+ * block of the class is large enough. Otherwise take the arena lock,
+ * find if there is a free block for current requirement, and prefetch
+ * a batch of same-sized blocks into the thread cache.
  */
 void *malloc (size_t size) {
 	size_t asize; /* Adjusted block size */
-	size_t extendsize; /* Amount to extend heap if not fit */
+	unsigned int class;
+	struct arena *a;
 	char *bp;
 
-	if (heap_listp == 0){
+	if (heap_gen == 0){
 		mm_init();
 	}
 
-	if (size <= 0){
+	if (size <= 0 || size > MAX_REQUEST){
 		return NULL;
 	}
 
-	asize = MAX(ALIGN(size + DSIZE), MINIMUM);
+	if (size >= MMAP_THRESHOLD){
+		return huge_malloc(size);
+	}
 
-	/* find if there is a free block to allocate */
-	if ((bp = find_fit(asize))) {
-		place(bp, asize);
+	a = thread_arena();
+	if (a->heap_listp == NULL && arena_init(a) == -1){
+		return NULL;
+	}
+
+	if (size <= SLAB_MAX && mem_arena_size(a->index) >= SLAB_MIN_HEAP){
+		spin_lock(&a->lock);
+		remote_drain(a);
+		bp = slab_malloc(a, SLAB_CLASS(size));
+		spin_unlock(&a->lock);
 		return bp;
 	}
-	/* If free block does not exist, extend the heap */
-	else if ((bp = find_fit(asize))== NULL) {
-		extendsize = MAX(asize, CHUNKSIZE);
-		if ((bp = extend_heap(extendsize/WSIZE)) == NULL){
-			return NULL;
+
+	asize = MAX(ALIGN(size + DSIZE), MINIMUM);
+
+	if (asize <= TCACHE_MAX){
+		class = get_list_number(asize/DSIZE);
+		tcache_check();
+		bp = tcache.entry[class];
+		if (bp != NULL && GET_SIZE(HDRP(bp)) >= asize){
+			tcache.entry[class] = TCACHE_NEXT(bp);
+			tcache.count[class]--;
+			tcache.stats.hits++;
+			return bp;
 		}
-		place(bp, asize);
+		tcache.stats.misses++;
+
+		spin_lock(&a->lock);
+		remote_drain(a);
+		bp = heap_malloc(a, asize);
+		if (bp != NULL){
+			tcache_refill(a, class, asize);
+		}
+		spin_unlock(&a->lock);
+		return bp;
 	}
 
+	spin_lock(&a->lock);
+	remote_drain(a);
+	bp = heap_malloc(a, asize);
+	spin_unlock(&a->lock);
 	return bp;
 }
 
 /*
  * free
- * Set current header and footer allocated bit to 0;
- * Add this block back to free block list;
- * Check if need to coalesce.
+ * Huge blocks are unmapped.
+ * Slab objects go back to their run.
+ * Small blocks go back to the thread cache, still marked allocated.
+ * When the class is full, half of it is flushed to the seg lists first.
+ * Blocks of another thread's arena go on that arena's remote queue.
+ * Other blocks are freed straight into the seg lists.
  */
 void free (void *ptr) {
+	unsigned int class;
+	struct slab_run *run;
+	struct arena *a;
+	int index;
+
 	if (ptr == 0){
 		return;
 	}
 
-	size_t size = GET_SIZE(HDRP(ptr));
+	if ((index = mem_arena_of(ptr)) < 0){
+		huge_free(ptr);
+		return;
+	}
+	a = &arenas[index];
 
-	if (heap_listp == 0){
-		mm_init();
+	if (a != thread_arena()){
+		remote_free(a, ptr);
+		return;
 	}
 
-	PUT(HDRP(ptr), PACK(size, 0));
-	PUT(FTRP(ptr), PACK(size, 0));
+	if ((run = slab_run_of(a, ptr)) != NULL){
+		spin_lock(&a->lock);
+		slab_free(a, run, ptr);
+		spin_unlock(&a->lock);
+		return;
+	}
 
-	ptr = add_block(ptr);
+	size_t size = GET_SIZE(HDRP(ptr));
+
+	if (size <= TCACHE_MAX){
+		class = get_list_number(size/DSIZE);
+		tcache_check();
+		if (GET_GROWTH(HDRP(ptr))){
+			/* Cached blocks are handed out again as they are */
+			PUT(HDRP(ptr), PACK(size, 1));
+			PUT(FTRP(ptr), PACK(size, 1));
+		}
+		if (tcache.count[class] >= TCACHE_COUNT){
+			spin_lock(&a->lock);
+			tcache_flush(a, class, TCACHE_BATCH);
+			spin_unlock(&a->lock);
+		}
+		TCACHE_NEXT(ptr) = tcache.entry[class];
+		tcache.entry[class] = ptr;
+		tcache.count[class]++;
+		return;
+	}
+
+	spin_lock(&a->lock);
+	heap_free(a, ptr);
+	spin_unlock(&a->lock);
 }
 
 /*
  * realloc
- * Simplest way to reallocte the blocks.
+ * Shrink in place, splitting off the tail when it can hold a block.
+ * Grow into the block's headroom if it has enough.
+ * Grow in place when the next block is free or is the end of the heap,
+ * sliding back into a free previous block if that is what it takes.
+ * Only then malloc a new block, copy and free the old one.
+ * Blocks that keep growing get headroom when they move, see HEADROOM.
+ * A growing block that shrinks by less than half keeps it.
+ * A slab object stays put while the new size keeps its class.
+ * A huge block is remapped while the new size stays huge. A block that
+ * grows huge moves to a mapping of its own, without headroom.
+ * A block resized in place stays in its arena, whichever thread asks.
  */
 void *realloc(void *ptr, size_t size) {
-	size_t oldsize;
+	size_t oldsize, used, target;
+	unsigned int growth;
 	void *newptr;
+	struct slab_run *run;
+	struct arena *a;
 	size_t asize = MAX(ALIGN(size) + DSIZE, MINIMUM);
 	/* If size <= 0 then this is just free, and we return NULL. */
 	if(size <= 0) {
@@ -259,31 +740,94 @@ void *realloc(void *ptr, size_t size) {
 		return malloc(size);
 	}
 
-	/* Get the size of the original block */
+	/* Too large for a header: fail and leave the block untouched */
+	if (size > MAX_REQUEST){
+		return NULL;
+	}
+
+	/* Get the payload size of the original block */
+	if (IS_HUGE(ptr)){
+		if (size >= MMAP_THRESHOLD){
+			return huge_realloc(ptr, size);
+		}
+		oldsize = HUGE_OF(ptr)->size - HUGE_OFFSET;
+		growth = 0;
+		target = asize;
+		goto move;
+	}
+	a = ARENA_OF(ptr);
+	if ((run = slab_run_of(a, ptr)) != NULL){
+		oldsize = (run->class + 1) * ALIGNMENT;
+		if (size <= oldsize && SLAB_CLASS(size) == run->class){
+			realloc_stats.in_place++;
+			return ptr;
+		}
+		growth = 0;
+		target = asize;
+		goto move;
+	}
+	spin_lock(&a->lock);
 	oldsize = GET_SIZE(HDRP(ptr));
-	
-	/* If the size doesn't need to be changed, return orig pointer */
-	if (asize == oldsize)
+	used = GET_SIZE(FTRP(ptr));
+	growth = GET_GROWTH(HDRP(ptr));
+
+	/* Grow into headroom, or keep it through a small shrink */
+	if (asize <= oldsize && (asize > used || (growth && 2 * asize >= oldsize))){
+		if (asize > used){
+			realloc_stats.headroom++;
+			realloc_stats.saved_bytes += used - DSIZE;
+			growth = MIN(growth + 1, GROWTH_MAX);
+		}
+		else {
+			realloc_stats.in_place++;
+		}
+		set_growth(ptr, growth, asize);
+		spin_unlock(&a->lock);
 		return ptr;
+	}
 	
 	/* If the size needs to be decreased, shrink the block and 
 	 * return the same pointer */
 	if(asize <= oldsize)
 	{
-		size = asize;
+		realloc_stats.in_place++;
 
 		/* If a new block couldn't fit in the remaining space, 
 		 * return the pointer */
-		if(oldsize - size <= MINIMUM)
+		if(oldsize - asize < MINIMUM){
+			PUT(HDRP(ptr), PACK(oldsize, 1));
+			PUT(FTRP(ptr), PACK(oldsize, 1));
+			spin_unlock(&a->lock);
 			return ptr;
-		PUT(HDRP(ptr), PACK(size, 1));
-		PUT(FTRP(ptr), PACK(size, 1));
-		PUT(HDRP(NEXT_BLKP(ptr)), PACK(oldsize-size, 1));
-		free(NEXT_BLKP(ptr));
+		}
+		PUT(HDRP(ptr), PACK(asize, 1));
+		PUT(FTRP(ptr), PACK(asize, 1));
+		PUT(HDRP(NEXT_BLKP(ptr)), PACK(oldsize-asize, 1));
+		heap_free(a, NEXT_BLKP(ptr));
+		spin_unlock(&a->lock);
 		return ptr;
 	}
 
-	newptr = malloc(size);
+	/* Grow in place if possible. Growing costs no copy here, so
+	 * headroom is only given to blocks that have to move */
+	growth = MIN(growth + 1, GROWTH_MAX);
+	if ((newptr = grow_block(a, ptr, asize)) != NULL){
+		set_growth(newptr, growth, asize);
+		spin_unlock(&a->lock);
+		return newptr;
+	}
+	spin_unlock(&a->lock);
+	oldsize = used - DSIZE;
+	target = asize;
+	if (growth >= HEADROOM_MIN && size < MMAP_THRESHOLD){
+		target += HEADROOM(asize);
+	}
+
+move:
+	newptr = malloc(target - DSIZE);
+	if (newptr == NULL && target != asize){
+		newptr = malloc(size);
+	}
 
 	/* If realloc() fails the original block is left untouched  */
 	if(!newptr) {
@@ -293,6 +837,19 @@ void *realloc(void *ptr, size_t size) {
 	/* Copy the old data. */
 	if(size < oldsize) oldsize = size;
 	memcpy(newptr, ptr, oldsize);
+	realloc_stats.copies++;
+	realloc_stats.copy_bytes += oldsize;
+
+	/* Record the growth on the new block if it has tags */
+	if (growth && !IS_HUGE(newptr)){
+		a = ARENA_OF(newptr);
+		if (slab_run_of(a, newptr) == NULL){
+			spin_lock(&a->lock);
+			realloc_stats.headroom_bytes += GET_SIZE(HDRP(newptr)) - asize;
+			set_growth(newptr, growth, asize);
+			spin_unlock(&a->lock);
+		}
+	}
 
 	/* Free the old block. */
 	free(ptr);
@@ -301,27 +858,849 @@ void *realloc(void *ptr, size_t size) {
 
 }
 
-/*
- * calloc
- * This function is not tested by mdriver, but it is
- * needed to run the traces.
+/*
+ * calloc
+ * This function is not tested by mdriver, but it is
+ * needed to run the traces.
+ */
+void *calloc (size_t nmemb, size_t size) {
+	size_t bytes = nmemb * size;
+	void *newptr;
+
+	newptr = malloc(bytes);
+
+	/* A fresh mapping is already zeroed */
+	if (newptr != NULL && !IS_HUGE(newptr)){
+		memset(newptr, 0, bytes);
+	}
+
+	return newptr;
+}
+
+
+
+
+/* Helper functions: Coalesce, extend, find fit, place,
+ *			   add block, delete block, get seg number.
+ */
+
+/* heap_malloc
+ * para: adjusted block size. Caller holds the arena lock.
+ * Find if there is a free block to allocate in the seg lists.
+ * If can't find a suitable block, extend the heap, and if even that
+ * fails, trim the realloc headroom of every block.
+ */
+static void *heap_malloc(struct arena *a, size_t asize)
+{
+	size_t extendsize; /* Amount to extend heap if not fit */
+	char *bp;
+
+	/* a deferred block of the very size needs nothing done to it */
+	if (DEFER_COALESCE && asize <= QUICK_MAX &&
+		(bp = a->quick[asize / ALIGNMENT]) != NULL){
+		a->quick[asize / ALIGNMENT] = QUICK_NEXT(bp);
+		a->quick_bytes -= asize;
+		a->coal.reused++;
+		return bp;
+	}
+
+	/* find if there is a free block to allocate, sweeping the deferred
+	 * blocks into the seg lists before giving up */
+	if ((bp = find_fit(a, asize)) == NULL && a->quick_bytes > 0){
+		quick_sweep(a);
+		bp = find_fit(a, asize);
+	}
+	if (bp) {
+		place(a, bp, asize);
+		return bp;
+	}
+
+	/* If free block does not exist, extend the heap */
+	extendsize = MAX(asize, CHUNKSIZE);
+	if ((bp = extend_heap(a, extendsize/WSIZE)) == NULL){
+		/* Out of heap: give back realloc headroom and look again */
+		if (trim_headroom(a) == 0 || (bp = find_fit(a, asize)) == NULL){
+			return NULL;
+		}
+	}
+	place(a, bp, asize);
+	return bp;
+}
+
+/* heap_free
+ * para: pointer to an allocated block. Caller holds the arena lock.
+ * Set current header and footer allocated bit to 0;
+ * Add this block back to free block list, coalescing as needed.
+ * Every PURGE_CHECK calls, see if a purge sweep is due. With
+ * DEFER_COALESCE, put a small block on its quick list instead.
+ */
+static void heap_free(struct arena *a, void *ptr)
+{
+	size_t size = GET_SIZE(HDRP(ptr));
+
+	if (DEFER_COALESCE && size <= QUICK_MAX){
+		/* Drop any growth bits, so it is handed out as a plain block */
+		PUT(HDRP(ptr), PACK(size, 1));
+		PUT(FTRP(ptr), PACK(size, 1));
+		QUICK_NEXT(ptr) = a->quick[size / ALIGNMENT];
+		a->quick[size / ALIGNMENT] = ptr;
+		a->coal.deferred++;
+		if ((a->quick_bytes += size) > QUICK_BUDGET){
+			quick_sweep(a);
+		}
+		return;
+	}
+
+	PUT(HDRP(ptr), PACK(size, 0));
+	PUT(FTRP(ptr), PACK(size, 0));
+	add_block(a, ptr);
+
+	if (PURGE_DECAY_MS && ++a->purge_ticks == PURGE_CHECK){
+		a->purge_ticks = 0;
+		purge_decay(a);
+	}
+}
+
+/* quick_sweep
+ * Caller holds the arena lock.
+ * Free every deferred block for real, coalescing it with its
+ * neighbours, and empty the quick lists.
+ */
+static void quick_sweep(struct arena *a)
+{
+	void *bp;
+	size_t size;
+
+	for (unsigned int i = 0; i < QUICK_LISTS; i++){
+		while ((bp = a->quick[i]) != NULL){
+			a->quick[i] = QUICK_NEXT(bp);
+			size = GET_SIZE(HDRP(bp));
+			PUT(HDRP(bp), PACK(size, 0));
+			PUT(FTRP(bp), PACK(size, 0));
+			add_block(a, bp);
+		}
+	}
+	a->quick_bytes = 0;
+	a->coal.sweeps++;
+}
+
+/* thread_arena
+ * Return the calling thread's arena, choosing one on first use:
+ * round-robin, or with -DARENA_BY_CPU the arena of the CPU the thread
+ * is running on. A thread keeps its arena, so its cache only ever holds
+ * blocks of that arena.
+ */
+static struct arena *thread_arena(void)
+{
+	int i = -1;
+
+	if (my_arena == NULL){
+#ifdef ARENA_BY_CPU
+		i = sched_getcpu();
+#endif
+		if (i < 0){
+			i = __sync_fetch_and_add(&next_arena, 1);
+		}
+		my_arena = &arenas[i % MEM_ARENAS];
+		pthread_once(&tcache_once, tcache_key_init);
+		pthread_setspecific(tcache_key, my_arena);
+	}
+	return my_arena;
+}
+
+/* spin_lock / spin_unlock
+ * Spin lock around every access to an arena's seg lists and heap, and
+ * to the huge list. Uncontended it costs one atomic exchange, which is
+ * all a single thread pays.
+ */
+static void spin_lock(volatile int *lock)
+{
+	while (__sync_lock_test_and_set(lock, 1)){
+		while (*lock)
+			;
+	}
+}
+
+static void spin_unlock(volatile int *lock)
+{
+	__sync_lock_release(lock);
+}
+
+/* tcache_check
+ * Drop the calling thread's cached blocks if mm_init has rebuilt the
+ * heap since they were cached.
+ */
+static void tcache_check(void)
+{
+	if (tcache.gen != heap_gen){
+		for (int i = 0; i < TCACHE_CLASSES; i++){
+			tcache.entry[i] = NULL;
+			tcache.count[i] = 0;
+		}
+		tcache.gen = heap_gen;
+	}
+}
+
+/* tcache_flush
+ * para: class to flush, number of blocks. Caller holds the arena lock.
+ * Return up to n cached blocks of the class to the seg lists.
+ */
+static void tcache_flush(struct arena *a, unsigned int class, unsigned int n)
+{
+	void *bp;
+
+	while (n-- > 0 && (bp = tcache.entry[class]) != NULL){
+		tcache.entry[class] = TCACHE_NEXT(bp);
+		tcache.count[class]--;
+		heap_free(a, bp);
+	}
+	tcache.stats.flushes++;
+}
+
+/* tcache_key_init / tcache_exit
+ * Once a thread has an arena, the key holds it, so that when the thread
+ * exits tcache_exit returns the thread's cached blocks to the arena.
+ * Otherwise they would stay allocated until the next mm_init.
+ */
+static void tcache_key_init(void)
+{
+	pthread_key_create(&tcache_key, tcache_exit);
+}
+
+static void tcache_exit(void *arena)
+{
+	struct arena *a = arena;
+
+	if (tcache.gen != heap_gen){
+		return;		/* Cached blocks of an old heap */
+	}
+	spin_lock(&a->lock);
+	for (unsigned int i = 0; i < TCACHE_CLASSES; i++){
+		if (tcache.entry[i] != NULL){
+			tcache_flush(a, i, TCACHE_COUNT);
+		}
+	}
+	spin_unlock(&a->lock);
+}
+
+/* tcache_refill
+ * para: class to refill, block size. Caller holds the arena lock.
+ * Prefetch up to TCACHE_BATCH whole free blocks of at least asize bytes
+ * from the head of the class's own seg list. Larger blocks are never
+ * split for it, so the cache does not carve up the heap.
+ */
+static void tcache_refill(struct arena *a, unsigned int class, size_t asize)
+{
+	void *bp;
+
+	for (int i = 0; i < TCACHE_BATCH &&
+		tcache.count[class] < TCACHE_COUNT; i++){
+		bp = SEG_ENTRY(a->seg_list, class);
+		if (bp == NULL || GET_SIZE(HDRP(bp)) < asize){
+			return;
+		}
+		place(a, bp, GET_SIZE(HDRP(bp)));
+		TCACHE_NEXT(bp) = tcache.entry[class];
+		tcache.entry[class] = bp;
+		tcache.count[class]++;
+		tcache.stats.refills++;
+	}
+}
+
+/* remote_free
+ * para: arena of the block, block or slab object pointer.
+ * Push the block on the arena's remote queue with compare-and-swap,
+ * still marked allocated, for a thread of the arena to free.
+ */
+static void remote_free(struct arena *a, void *ptr)
+{
+	struct slab_run *run = slab_run_of(a, ptr);
+	void *head;
+
+	__sync_fetch_and_add(&remote_stats.frees, 1);
+	__sync_fetch_and_add(&remote_stats.bytes, run != NULL ?
+		(size_t)(run->class + 1) * ALIGNMENT : (size_t)GET_SIZE(HDRP(ptr)));
+	do {
+		head = a->remote;
+		REMOTE_NEXT(ptr) = head;
+	} while (!__sync_bool_compare_and_swap(&a->remote, head, ptr));
+}
+
+/* remote_drain
+ * para: an arena. Caller holds the arena lock.
+ * Take the arena's whole remote queue in one swap, so that pushes never
+ * race with a pop, and free every block on it: slab objects back into
+ * their runs, other blocks into the seg lists, coalescing as usual.
+ */
+static void remote_drain(struct arena *a)
+{
+	void *bp, *next;
+	struct slab_run *run;
+	unsigned long n = 0;
+
+	if (a->remote == NULL){
+		return;
+	}
+	do {
+		bp = a->remote;
+	} while (!__sync_bool_compare_and_swap(&a->remote, bp, NULL));
+
+	for (; bp != NULL; bp = next){
+		next = REMOTE_NEXT(bp);
+		if ((run = slab_run_of(a, bp)) != NULL){
+			slab_free(a, run, bp);
+		}
+		else {
+			heap_free(a, bp);
+		}
+		n++;
+	}
+	__sync_fetch_and_add(&remote_stats.drains, 1);
+	__sync_fetch_and_add(&remote_stats.drained, n);
+}
+
+/* slab_malloc
+ * para: slab class. Caller holds the arena lock.
+ * Take an object from the first partial run of the class, reusing
+ * freed objects before carving new ones. A run that fills up leaves
+ * the partial list. Start a new run if the class has none.
+ */
+static void *slab_malloc(struct arena *a, unsigned int class)
+{
+	struct slab_run *run = a->slab_partial[class];
+	size_t osize = (class + 1) * ALIGNMENT;
+	void *bp;
+
+	if (run == NULL && (run = new_run(a, class)) == NULL){
+		return NULL;
+	}
+
+	if ((bp = run->free) != NULL){
+		run->free = *(void **)bp;
+	}
+	else {
+		bp = (char *)run + run->bump;
+		run->bump += osize;
+	}
+	run->used++;
+
+	/* Full: no freed objects and no room left to carve */
+	if (run->free == NULL && run->bump + osize > RUN_SIZE - DSIZE){
+		a->slab_partial[class] = run->next;
+		if (run->next != NULL){
+			run->next->prev = NULL;
+		}
+		run->next = run->prev = NULL;
+	}
+	return bp;
+}
+
+/* slab_free
+ * para: the object's run, object pointer. Caller holds the arena lock.
+ * Push the object on the run's free list. A full run goes back on the
+ * partial list; a run left empty is returned to the seg lists, unless
+ * it is the only partial run of its class.
+ */
+static void slab_free(struct arena *a, struct slab_run *run, void *ptr)
+{
+	size_t osize = (run->class + 1) * ALIGNMENT;
+	struct slab_run **head = &a->slab_partial[run->class];
+
+	if (run->free == NULL && run->bump + osize > RUN_SIZE - DSIZE){
+		run->next = *head;
+		run->prev = NULL;
+		if (*head != NULL){
+			(*head)->prev = run;
+		}
+		*head = run;
+	}
+	*(void **)ptr = run->free;
+	run->free = ptr;
+
+	if (--run->used == 0 && (run->prev != NULL || run->next != NULL)){
+		release_run(a, run);
+	}
+}
+
+/* release_run
+ * para: an empty partial run. Caller holds the arena lock.
+ * Take the run off its partial list and the run map, and free it.
+ */
+static void release_run(struct arena *a, struct slab_run *run)
+{
+	size_t run_idx;
+
+	if (run->prev != NULL){
+		run->prev->next = run->next;
+	}
+	else {
+		a->slab_partial[run->class] = run->next;
+	}
+	if (run->next != NULL){
+		run->next->prev = run->prev;
+	}
+	run_idx = ((char *)run - a->lo) >> RUN_SHIFT;
+	a->run_map[run_idx / (8 * sizeof(long))] &=
+		~(1UL << (run_idx % (8 * sizeof(long))));
+	heap_free(a, run);
+}
+
+/* slab_run_of
+ * para: a pointer returned by malloc.
+ * Return the run holding the object, or NULL if ptr is a block with
+ * boundary tags, looked up in the run bitmap.
+ */
+static struct slab_run *slab_run_of(struct arena *a, const void *ptr)
+{
+	size_t run_idx = ((char *)ptr - a->lo) >> RUN_SHIFT;
+
+	if (!((a->run_map[run_idx / (8 * sizeof(long))] >>
+		(run_idx % (8 * sizeof(long)))) & 1)){
+		return NULL;
+	}
+	return RUN_OF(ptr);
+}
+
+/* new_run
+ * para: slab class. Caller holds the arena lock.
+ * Allocate an aligned run block, from the seg lists if a free block
+ * holds one, otherwise from fresh heap, and make it the only partial
+ * run of the class.
+ */
+static struct slab_run *new_run(struct arena *a, unsigned int class)
+{
+	struct slab_run *run;
+	char *top, *last, *run_hdr;
+	long need;
+	size_t run_idx;
+
+	if ((run = run_fit(a)) == NULL){
+		/* Grow the heap so that its last free block ends just past, or
+		 * at least MINIMUM bytes past, an aligned run placed the same
+		 * way carve_run will place it */
+		top = (char *)mem_arena_hi(a->index) + 1 - WSIZE; /* epilogue header */
+		last = top;
+		if (!GET_ALLOC(top - WSIZE)){
+			last -= GET_SIZE(top - WSIZE);
+		}
+		run_hdr = (char *)((((size_t)last + WSIZE - RUN_OFFSET +
+			RUN_SIZE - 1) & ~(RUN_SIZE - 1)) + RUN_OFFSET - WSIZE);
+		if (run_hdr != last && run_hdr - last < MINIMUM){
+			run_hdr += RUN_SIZE;
+		}
+		need = run_hdr + RUN_SIZE - top;
+		if (need < MINIMUM){
+			need += MINIMUM;
+		}
+		if ((run = extend_heap(a, need/WSIZE)) == NULL ||
+			(run = carve_run(a, run)) == NULL){
+			return NULL;
+		}
+	}
+
+	run->next = run->prev = NULL;
+	run->free = NULL;
+	run->bump = ALIGN(sizeof(struct slab_run));
+	run->used = 0;
+	run->class = class;
+	a->slab_partial[class] = run;
+
+	run_idx = ((char *)run - a->lo) >> RUN_SHIFT;
+	a->run_map[run_idx / (8 * sizeof(long))] |=
+		1UL << (run_idx % (8 * sizeof(long)));
+	return run;
+}
+
+/* carve_run
+ * para: pointer to a free block.
+ * If the block holds a run block whose payload sits RUN_OFFSET bytes
+ * into an aligned slot, with nothing or at least MINIMUM bytes left on
+ * either side, allocate it and free the rest. Return the run payload,
+ * or NULL if it does not fit.
+ */
+static void *carve_run(struct arena *a, void *bp)
+{
+	char *start = HDRP(bp);
+	char *end = start + GET_SIZE(start);
+	char *run;
+
+	run = (char *)((((size_t)bp - RUN_OFFSET + RUN_SIZE - 1) &
+		~(RUN_SIZE - 1)) + RUN_OFFSET);
+	if (run != (char *)bp && run - (char *)bp < MINIMUM){
+		run += RUN_SIZE;
+	}
+	if (run + RUN_SIZE > end + WSIZE ||
+		(run + RUN_SIZE != end + WSIZE &&
+		 end + WSIZE - (run + RUN_SIZE) < MINIMUM)){
+		return NULL;
+	}
+
+	delete_block(a, bp);
+	PUT(HDRP(run), PACK(RUN_SIZE, 1));
+	PUT(FTRP(run), PACK(RUN_SIZE, 1));
+	if (run != (char *)bp){
+		PUT(HDRP(bp), PACK(run - (char *)bp, 0));
+		PUT(FTRP(bp), PACK(run - (char *)bp, 0));
+		add_block(a, bp);
+	}
+	if (run + RUN_SIZE != end + WSIZE){
+		bp = NEXT_BLKP(run);
+		PUT(HDRP(bp), PACK(end - (char *)HDRP(bp), 0));
+		PUT(FTRP(bp), PACK(end - (char *)HDRP(bp), 0));
+		add_block(a, bp);
+	}
+	return run;
+}
+
+/* run_fit
+ * Search the seg lists that may hold a block of RUN_SIZE bytes or more
+ * for one that an aligned run can be carved from.
+ */
+static void *run_fit(struct arena *a)
+{
+	void *bp, *run;
+	unsigned int i;
+	unsigned long map = a->seg_map &
+		(~0UL << get_list_number(RUN_SIZE/DSIZE));
+
+	while (map){
+		i = __builtin_ctzl(map);
+		for (bp = SEG_ENTRY(a->seg_list, i); bp != NULL; bp = NEXT_FRPT(bp)){
+			if ((run = carve_run(a, bp)) != NULL){
+				return run;
+			}
+		}
+		map &= map - 1;
+	}
+	return NULL;
+}
+
+/* huge_malloc
+ * para: requested size in bytes.
+ * Map a huge block for size bytes of payload, whole pages.
+ */
+static void *huge_malloc(size_t size)
+{
+	size_t mapsize = (size + HUGE_OFFSET + mem_pagesize() - 1) &
+		~(mem_pagesize() - 1);
+	struct huge_block *hb;
+
+	if ((hb = mem_map(mapsize)) == NULL){
+		return NULL;
+	}
+	hb->size = mapsize;
+	spin_lock(&huge_lock);
+	huge_link(hb);
+	spin_unlock(&huge_lock);
+	return (char *)hb + HUGE_OFFSET;
+}
+
+/* huge_free
+ * para: payload of a huge block.
+ * Give the mapping back to the system.
+ */
+static void huge_free(void *ptr)
+{
+	struct huge_block *hb = HUGE_OF(ptr);
+
+	spin_lock(&huge_lock);
+	huge_unlink(hb);
+	spin_unlock(&huge_lock);
+	mem_unmap(hb);
+}
+
+/* huge_realloc
+ * para: payload of a huge block, new size of at least MMAP_THRESHOLD.
+ * Resize the mapping, which may move it but never copies the payload.
+ * Return the payload, or NULL with the block untouched on failure.
+ */
+static void *huge_realloc(void *ptr, size_t size)
+{
+	size_t mapsize = (size + HUGE_OFFSET + mem_pagesize() - 1) &
+		~(mem_pagesize() - 1);
+	struct huge_block *hb = HUGE_OF(ptr);
+	struct huge_block *new_hb;
+
+	if (mapsize == hb->size){
+		realloc_stats.in_place++;
+		return ptr;
+	}
+	spin_lock(&huge_lock);
+	huge_unlink(hb);
+	spin_unlock(&huge_lock);
+	if ((new_hb = mem_remap(hb, mapsize)) != NULL){
+		hb = new_hb;
+		hb->size = mapsize;
+		realloc_stats.remap++;
+	}
+	spin_lock(&huge_lock);
+	huge_link(hb);
+	spin_unlock(&huge_lock);
+	return new_hb == NULL ? NULL : (char *)hb + HUGE_OFFSET;
+}
+
+/* huge_link, huge_unlink
+ * para: a huge block. Caller holds the huge lock.
+ * Push the block on the huge list, or take it off.
+ */
+static void huge_link(struct huge_block *hb)
+{
+	hb->prev = NULL;
+	hb->next = huge_list;
+	if (huge_list != NULL){
+		huge_list->prev = hb;
+	}
+	huge_list = hb;
+}
+
+static void huge_unlink(struct huge_block *hb)
+{
+	if (hb->prev != NULL){
+		hb->prev->next = hb->next;
+	}
+	else {
+		huge_list = hb->next;
+	}
+	if (hb->next != NULL){
+		hb->next->prev = hb->prev;
+	}
+}
+
+/* purge_free
+ * para: purge epoch. Caller holds the arena lock.
+ * Purge the whole pages inside every free block of PURGE_MIN bytes or
+ * more stamped before the given epoch, past its links, stamp and tree
+ * node and short of its footer, and mark it purged. Return the bytes purged.
+ */
+static size_t purge_free(struct arena *a, unsigned long before)
+{
+	size_t purged = 0;
+	unsigned int i;
+	unsigned long map = a->seg_map &
+		(~0UL << get_list_number(PURGE_MIN/DSIZE));
+	char *bp;
+
+	while (map){
+		i = __builtin_ctzl(map);
+		for (bp = SEG_ENTRY(a->seg_list, i); bp != NULL; bp = NEXT_FRPT(bp)){
+			if (GET_SIZE(HDRP(bp)) < PURGE_MIN || PURGE_STAMP(bp) >= before){
+				continue;
+			}
+			purged += mem_purge(TREE_END(bp), (char *)FTRP(bp) - TREE_END(bp));
+			PURGE_STAMP(bp) = PURGED;
+		}
+		map &= map - 1;
+	}
+	return purged;
+}
+
+/* purge_decay
+ * Caller holds the arena lock. Sweep if PURGE_DECAY_MS have passed since
+ * the last sweep: trim a large free block ending the heap, and purge
+ * the blocks that have been free since before the last sweep.
+ */
+static void purge_decay(struct arena *a)
+{
+	struct timespec ts;
+	unsigned long now;
+	char *end = (char *)mem_arena_hi(a->index) + 1;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	now = ts.tv_sec * 1000UL + ts.tv_nsec / 1000000;
+	if (now - a->purge_last < PURGE_DECAY_MS){
+		return;
+	}
+	a->purge_last = now;
+	if (!GET_ALLOC(end - DSIZE) && GET_SIZE(end - DSIZE) >= TRIM_THRESHOLD){
+		trim_tail(a, TRIM_PAD);
+	}
+	purge_free(a, a->purge_epoch++);
+}
+
+/* trim_tail
+ * para: bytes of free space to leave. Caller holds the arena lock.
+ * If the last block of the heap is free, shrink the heap so that it
+ * keeps pad bytes, or drop the block if less than MINIMUM would be left.
+ * Return the bytes given back.
+ */
+static size_t trim_tail(struct arena *a, size_t pad)
+{
+	char *end = (char *)mem_arena_hi(a->index) + 1; /* just past the epilogue */
+	char *bp;
+	size_t size, keep;
+
+	if (GET_ALLOC(end - DSIZE)){
+		return 0;
+	}
+	size = GET_SIZE(end - DSIZE);
+	bp = end - size;
+	keep = pad & ~(size_t)(DSIZE - 1);
+	if (keep < MINIMUM){
+		keep = 0;
+	}
+	if (keep >= size){
+		return 0;
+	}
+
+	delete_block(a, bp);
+	if (keep){
+		PUT(HDRP(bp), PACK(keep, 0));
+		PUT(FTRP(bp), PACK(keep, 0));
+	}
+	PUT(HDRP(bp) + keep, PACK(0, 1)); /* New epilogue header */
+	mem_arena_sbrk(a->index, -(intptr_t)(size - keep));
+	if (keep){
+		add_block(a, bp);
+	}
+	return size - keep;
+}
+
+/*
+ * mm_trim
+ * Give free memory back to the system: flush the calling thread's
+ * cache, and in every arena free the blocks on its remote queue and the
+ * empty run each slab class keeps, shrink the heap to its last allocated
+ * block, and purge the pages inside every free block of PURGE_MIN bytes
+ * or more. Blocks in other live threads' caches stay allocated. Return
+ * the bytes given back.
+ */
+size_t mm_trim(void)
+{
+	struct arena *mine = thread_arena();
+	struct arena *a;
+	size_t released = 0;
+
+	tcache_check();
+	for (int k = 0; k < MEM_ARENAS; k++){
+		a = &arenas[k];
+		if (a->heap_listp == NULL){
+			continue;
+		}
+		spin_lock(&a->lock);
+		remote_drain(a);
+		for (unsigned int i = 0; a == mine && i < TCACHE_CLASSES; i++){
+			tcache_flush(a, i, TCACHE_COUNT);
+		}
+		quick_sweep(a);
+		for (unsigned int i = 0; i < SLAB_CLASSES; i++){
+			if (a->slab_partial[i] != NULL && a->slab_partial[i]->used == 0){
+				release_run(a, a->slab_partial[i]);
+			}
+		}
+		released += trim_tail(a, 0) + purge_free(a, PURGED);
+		spin_unlock(&a->lock);
+	}
+	return released;
+}
+
+/* grow_block
+ * para: allocated block ptr, adjusted size larger than the block.
+ * Caller holds the arena lock.
+ * Grow the block in place: into the next block if it is free and big
+ * enough, or else by extending the heap when the block, or the free
+ * block after it, is the last one. Failing that, if the free previous
+ * block (with the free next block) makes room, slide the payload back
+ * into it with memmove. Any tail of MINIMUM bytes or more is freed.
+ * Return the block, or NULL if none of these fit.
+ */
+static void *grow_block(struct arena *a, void *ptr, size_t asize)
+{
+	size_t size = GET_SIZE(HDRP(ptr));
+	void *next = NEXT_BLKP(ptr);
+	void *prev;
+	size_t used;
+	size_t next_size = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+	size_t prev_size = GET_ALLOC(HDRP(ptr) - WSIZE) ? 0 :
+		GET_SIZE(HDRP(ptr) - WSIZE);
+
+	if (size + next_size >= asize){
+		realloc_stats.grow_next++;
+	}
+	else if (GET_SIZE(HDRP(next_size ? NEXT_BLKP(next) : next)) == 0){
+		/* Last block: the new free block coalesces with a free next */
+		if (extend_heap(a, (asize - size - next_size) / WSIZE) == NULL){
+			return NULL;
+		}
+		next_size = GET_SIZE(HDRP(next));
+		realloc_stats.grow_tail++;
+	}
+	else if (prev_size + size + next_size >= asize){
+		prev = PREV_BLKP(ptr);
+		used = GET_SIZE(FTRP(ptr)) - DSIZE;
+		delete_block(a, prev);
+		memmove(prev, ptr, used);
+		realloc_stats.copy_bytes += used;
+		size += prev_size;
+		ptr = prev;
+		PUT(HDRP(ptr), PACK(size, 1));
+		PUT(FTRP(ptr), PACK(size, 1));
+		realloc_stats.grow_prev++;
+	}
+	else {
+		return NULL;
+	}
+
+	if (next_size){
+		delete_block(a, next);
+		size += next_size;
+	}
+	if (size - asize >= MINIMUM){
+		PUT(HDRP(ptr), PACK(asize, 1));
+		PUT(FTRP(ptr), PACK(asize, 1));
+		next = NEXT_BLKP(ptr);
+		PUT(HDRP(next), PACK(size - asize, 0));
+		PUT(FTRP(next), PACK(size - asize, 0));
+		add_block(a, next);
+	}
+	else {
+		PUT(HDRP(ptr), PACK(size, 1));
+		PUT(FTRP(ptr), PACK(size, 1));
+	}
+	return ptr;
+}
+
+/* set_growth
+ * para: allocated block, growth count, size in use. Caller holds the
+ * arena lock. Record the block's growth in its header and, while that
+ * is non-zero, the size in use in its footer.
  */
-void *calloc (size_t nmemb, size_t size) {
-	size_t bytes = nmemb * size;
-	void *newptr;
-
-	newptr = malloc(bytes);
-	memset(newptr, 0, bytes);
+static void set_growth(void *bp, unsigned int growth, size_t used)
+{
+	size_t size = GET_SIZE(HDRP(bp));
 
-	return newptr;
+	PUT(HDRP(bp), PACK(size, 1) | (growth << GROWTH_SHIFT));
+	PUT(FTRP(bp), PACK(growth ? used : size, 1));
 }
 
-
-
-
-/* Helper functions: Coalesce, extend, find fit, place,
- *			   add block, delete block, get seg number.
+/* trim_headroom
+ * Caller holds the arena lock. Walk the heap and cut every growing
+ * block back to the size in use, freeing tails of MINIMUM bytes or
+ * more. Return the number of bytes freed.
  */
+static size_t trim_headroom(struct arena *a)
+{
+	size_t size, used, freed = 0;
+	void *bp;
+
+	for (bp = a->heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)){
+		if (!GET_ALLOC(HDRP(bp)) || !GET_GROWTH(HDRP(bp))){
+			continue;
+		}
+		size = GET_SIZE(HDRP(bp));
+		used = GET_SIZE(FTRP(bp));
+		if (size - used < MINIMUM){
+			used = size;
+		}
+		PUT(HDRP(bp), PACK(used, 1));
+		PUT(FTRP(bp), PACK(used, 1));
+		if (used < size){
+			PUT(HDRP(NEXT_BLKP(bp)), PACK(size - used, 1));
+			heap_free(a, NEXT_BLKP(bp));
+			freed += size - used;
+		}
+	}
+	return freed;
+}
 
 /* coalesce
  * para: current pointer ptr to a free block.
@@ -329,8 +1708,8 @@ void *calloc (size_t nmemb, size_t size) {
  * If any of the previous or next block is free,
  * coalesce those blocks.
  */
-static void *coalesce(void *ptr) {
-	size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(ptr)));
+static void *coalesce(struct arena *a, void *ptr) {
+	size_t prev_alloc = GET_ALLOC(HDRP(ptr) - WSIZE); /* previous footer */
 	size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
 	size_t size = GET_SIZE(HDRP(ptr));
 
@@ -338,11 +1717,12 @@ static void *coalesce(void *ptr) {
 		/* pre block and next block both been allocated */
 		return ptr;
 	}
+	a->coal.merges += 2 - prev_alloc - next_alloc;
 
 	if (prev_alloc && !next_alloc){
 		/* next block not allocated */
 		size += GET_SIZE(HDRP(NEXT_BLKP(ptr)));
-		delete_block(NEXT_BLKP(ptr));
+		delete_block(a, NEXT_BLKP(ptr));
 		PUT(HDRP(ptr), PACK(size, 0));
 		PUT(FTRP(ptr), PACK(size, 0));
 	}
@@ -351,7 +1731,7 @@ static void *coalesce(void *ptr) {
 		/* previous block not allocated */
 		ptr = PREV_BLKP(ptr);
 		size += GET_SIZE(HDRP(ptr));
-		delete_block(ptr);
+		delete_block(a, ptr);
 		PUT(HDRP(ptr), PACK(size, 0));
 		PUT(FTRP(ptr), PACK(size, 0));
 	}
@@ -360,8 +1740,8 @@ static void *coalesce(void *ptr) {
 		/* Both blocks not allocated */
 		size = size + GET_SIZE(HDRP(PREV_BLKP(ptr))) 
 		+ GET_SIZE(FTRP(NEXT_BLKP(ptr)));
-		delete_block(PREV_BLKP(ptr));
-		delete_block(NEXT_BLKP(ptr));
+		delete_block(a, PREV_BLKP(ptr));
+		delete_block(a, NEXT_BLKP(ptr));
 		PUT(HDRP(PREV_BLKP(ptr)), PACK(size, 0));
 		PUT(FTRP(NEXT_BLKP(ptr)), PACK(size, 0));
 		ptr = PREV_BLKP(ptr);
@@ -375,7 +1755,7 @@ static void *coalesce(void *ptr) {
  * Initialize header, footer and epilougue header.
  * Add new free block to the list, and coalesce.
  */
-static void *extend_heap(size_t words)
+static void *extend_heap(struct arena *a, size_t words)
 {
 	char *bp;
 	size_t size;
@@ -384,7 +1764,7 @@ static void *extend_heap(size_t words)
 	if (size < MINIMUM){
 		size = MINIMUM;
 	}
-	if ((long)(bp = mem_sbrk(size)) == -1){
+	if ((long)(bp = mem_arena_sbrk(a->index, size)) == -1){
 		return NULL;
 	}
  
@@ -393,30 +1773,58 @@ static void *extend_heap(size_t words)
 	PUT(FTRP(bp), PACK(size, 0)); /* Free block footer */
 	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
 
-	bp = add_block(bp);
+	bp = add_block(a, bp);
 	/* coalesce if the previous block was free */
 	return bp;
 }
 
 /* find fit
  * para: required size.
- * Using first fit, search from the most close segregate to the 
- * largest one, if there is a fit, return the pointer to the free block.
+ * Search from the most close segregate to the largest one, and return
+ * the free block fit_policy picks among those that fit, or NULL. The
+ * top seg is searched in its size tree, for the best fit.
+ * Only non-empty segs are visited: the next one is the lowest set bit
+ * of seg_map at or above the current entry.
  */
-static void *find_fit(size_t size)
+static void *find_fit(struct arena *a, size_t size)
 {
-	void *bp;
+	void *bp, *best = NULL;
+	size_t bsize, best_size = 0;
+	unsigned int i, fits = 0;
 
 	unsigned int entry_num = get_list_number(size/DSIZE);
+	unsigned long map = a->seg_map & (~0UL << entry_num);
 
-	for (int i = entry_num; i < SEG_NUM; i++){
-		for (bp = SEG_ENTRY(seg_list, i); 
+	a->fit.searches++;
+	while (map){
+		i = __builtin_ctzl(map);
+		if (FREE_TREE && i == TREE_SEG){
+			return tree_fit(a, size);
+		}
+		for (bp = SEG_ENTRY(a->seg_list, i); 
 			(bp != NULL) && GET_SIZE(HDRP(bp)) > 0; 
 			bp = NEXT_FRPT(bp)){
-			if (size <= (size_t)GET_SIZE(HDRP(bp))){
-				return bp;
+			a->fit.nodes++;
+			bsize = GET_SIZE(HDRP(bp));
+			if (size > bsize){
+				continue;
+			}
+			if (best == NULL || bsize < best_size){
+				best = bp;
+				best_size = bsize;
 			}
+			if (fit_policy == FIT_FIRST || bsize == size ||
+				(fit_policy == FIT_BEST_OF && ++fits >= fit_best_n) ||
+				(fit_policy == FIT_GOOD &&
+				 (i != entry_num || bsize - size <= size / GOOD_SLACK))){
+				return best;
+			}
+		}
+		/* Later segs only hold larger blocks */
+		if (best != NULL){
+			return best;
 		}
+		map &= map - 1;
 	}
 	return NULL;
 }
@@ -426,7 +1834,7 @@ static void *find_fit(size_t size)
  * remaining block is larger than minimum size. Otherwise
  * allocte entire free block.
  */
-static void place(void *bp, size_t asize)
+static void place(struct arena *a, void *bp, size_t asize)
 {
 	/* 
 	 *Get the size of the allocated block 
@@ -436,17 +1844,18 @@ static void place(void *bp, size_t asize)
 
 	if ((csize - asize) >= MINIMUM){
 		/* Split */
-		delete_block(bp);
+		a->coal.splits++;
+		delete_block(a, bp);
 		PUT(HDRP(bp), PACK(asize, 1));
 		PUT(FTRP(bp), PACK(asize, 1));
 		bp = NEXT_BLKP(bp);
 		PUT(HDRP(bp), PACK(csize - asize, 0));
 		PUT(FTRP(bp), PACK(csize - asize, 0));
-		bp = add_block(bp);
+		bp = add_block(a, bp);
 	}
 	else {
 		/* Allocate entire block */
-		delete_block(bp);
+		delete_block(a, bp);
 		PUT(HDRP(bp), PACK(csize, 1));
 		PUT(FTRP(bp), PACK(csize, 1));
 	}
@@ -454,69 +1863,322 @@ static void place(void *bp, size_t asize)
 
 /* add_block
  * para: pointer to current block
- * Coalesce first, then check the size of the block.
- * LIFO, add free block to suitable segregated list.
- * Handle the condition that this is the first block in this list.
+ * Coalesce first, then check the size of the block, and link the
+ * free block into its segregated list where free_order puts it.
  */
-static void *add_block(void *bp)
+static void *add_block(struct arena *a, void *bp)
 {
-	bp = coalesce(bp);
+	bp = coalesce(a, bp);
 
-	int size = GET_SIZE(HDRP(bp));
+	size_t size = GET_SIZE(HDRP(bp));
 	unsigned int seg_number = get_list_number(size/DSIZE);
+	void *prev = NULL;
 
-	/* Handle the case this is the first block ever added to current seg */
-	if (SEG_ENTRY(seg_list, seg_number) == NULL){
-		NEXT_FRPT(bp) = NULL;
-		PREV_FRPT(bp) = NULL;
-		SEG_ENTRY(seg_list, seg_number) = bp;
-	}
-	else if (SEG_ENTRY(seg_list, seg_number)){
-		NEXT_FRPT(bp) = SEG_ENTRY(seg_list, seg_number);
-		PREV_FRPT(bp) = NULL;
-		PREV_FRPT(SEG_ENTRY(seg_list, seg_number)) = bp;
-		SEG_ENTRY(seg_list, seg_number) = bp;
+	if (size >= PURGE_MIN){
+		PURGE_STAMP(bp) = a->purge_epoch;
 	}
 
+	a->fit.inserts++;
+	if (free_order == ORDER_FIFO){
+		prev = a->seg_tail[seg_number];
+	}
+	else if (free_order == ORDER_ADDR){
+		prev = addr_prev(a, bp, seg_number);
+	}
+	link_block(a, bp, seg_number, prev);
+	if (FREE_TREE && seg_number == TREE_SEG){
+		tree_insert(a, bp);
+	}
 
 	return bp;
 }
 
+/* link_block
+ * para: free block, its seg, and the block of the seg it goes after,
+ * NULL to go first.
+ * Link the block into the seg list, keeping the seg entry, the seg's
+ * tail and seg_map up to date.
+ */
+static void link_block(struct arena *a, void *bp, unsigned int seg,
+	void *prev)
+{
+	void *next = prev ? NEXT_FRPT(prev) : SEG_ENTRY(a->seg_list, seg);
+
+	PREV_FRPT(bp) = prev;
+	NEXT_FRPT(bp) = next;
+	if (prev){
+		NEXT_FRPT(prev) = bp;
+	}
+	else {
+		SEG_ENTRY(a->seg_list, seg) = bp;
+		a->seg_map |= 1UL << seg;
+	}
+	if (next){
+		PREV_FRPT(next) = bp;
+	}
+	else {
+		a->seg_tail[seg] = bp;
+	}
+}
+
+/* addr_index_map
+ * Map the zeroed address order index of every arena, outside the
+ * simulated heap so it does not count against it, and keep it from
+ * then on. Return -1 on error, 0 on success.
+ */
+static int addr_index_map(void)
+{
+	size_t map_bytes = MEM_ARENAS * sizeof(*addr_map);
+	size_t bytes = map_bytes + MEM_ARENAS * sizeof(*addr_first);
+	char *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (p == MAP_FAILED){
+		return -1;
+	}
+	addr_first = (void *)(p + map_bytes);
+	addr_map = (void *)p;
+	return 0;
+}
+
+/* addr_prev
+ * para: free block, its seg.
+ * Enter the block in the seg's address index and return the block of
+ * the seg it follows in address order, or NULL if it goes first. If the
+ * block's span already holds blocks of the seg, step from the lowest of
+ * them; otherwise it goes before the lowest block of the next span
+ * that has one, or at the tail.
+ */
+static void *addr_prev(struct arena *a, void *bp, unsigned int seg)
+{
+	unsigned long *map = addr_map[a->index][seg];
+	void **first = addr_first[a->index][seg];
+	size_t span = ADDR_SPAN_OF(a, bp);
+	size_t w = span / (8 * sizeof(long));
+	unsigned long bit = 1UL << (span % (8 * sizeof(long)));
+	unsigned long bits;
+	void *prev, *next;
+
+	if (map[w] & bit){
+		if (bp < first[span]){
+			prev = PREV_FRPT(first[span]);
+			first[span] = bp;
+			return prev;
+		}
+		for (prev = first[span]; (next = NEXT_FRPT(prev)) != NULL &&
+			next < bp; prev = next){
+			a->fit.steps++;
+		}
+		return prev;
+	}
+
+	map[w] |= bit;
+	first[span] = bp;
+	if (w >= a->addr_words){
+		a->addr_words = w + 1;
+	}
+	prev = a->seg_tail[seg];
+	if (prev == NULL || prev < bp){
+		return prev;
+	}
+	bits = map[w] & ~(bit | (bit - 1));
+	while (bits == 0){
+		bits = map[++w];
+	}
+	return PREV_FRPT(first[w * (8 * sizeof(long)) + __builtin_ctzl(bits)]);
+}
+
 /* delete_block
  * para: pointer to current block
- * Remove the allocated block from the free blocks list
- * Check the condition, whether previous or next pointer is pointed
- * to other free blocks.
+ * Remove the allocated block from the free blocks list, from the size
+ * tree, and from the address index if the block is the lowest of its
+ * span.
  */
-static void delete_block(void *bp)
+static void delete_block(struct arena *a, void *bp)
 {
-	int size = GET_SIZE(HDRP(bp));
+	size_t size = GET_SIZE(HDRP(bp));
 	unsigned int seg_number = get_list_number(size/DSIZE);
+	void *prev = PREV_FRPT(bp);
+	void *next = NEXT_FRPT(bp);
 
+	if (FREE_TREE && seg_number == TREE_SEG){
+		tree_remove(a, bp);
+	}
+	if (free_order == ORDER_ADDR){
+		size_t span = ADDR_SPAN_OF(a, bp);
 
-	if (bp == SEG_ENTRY(seg_list, seg_number))
-	{
-		SEG_ENTRY(seg_list, seg_number) = NEXT_FRPT(bp);
+		if (addr_first[a->index][seg_number][span] == bp){
+			if (next != NULL && ADDR_SPAN_OF(a, next) == span){
+				addr_first[a->index][seg_number][span] = next;
+			}
+			else {
+				addr_map[a->index][seg_number][span / (8 * sizeof(long))] &=
+					~(1UL << (span % (8 * sizeof(long))));
+			}
+		}
+	}
+
+	if (prev){
+		NEXT_FRPT(prev) = next;
+	}
+	else {
+		SEG_ENTRY(a->seg_list, seg_number) = next;
+		if (next == NULL){
+			a->seg_map &= ~(1UL << seg_number);
+		}
+	}
+	if (next){
+		PREV_FRPT(next) = prev;
+	}
+	else {
+		a->seg_tail[seg_number] = prev;
 	}
+	PREV_FRPT(bp) = NULL;
+	NEXT_FRPT(bp) = NULL;
+}
+
 
-	if (PREV_FRPT(bp) && NEXT_FRPT(bp)){
-		NEXT_FRPT(PREV_FRPT(bp)) = NEXT_FRPT(bp);
-		PREV_FRPT(NEXT_FRPT(bp)) = PREV_FRPT(bp);
-		PREV_FRPT(bp) = NULL;
-		NEXT_FRPT(bp) = NULL;
+/* tree_insert
+ * para: free block of the top seg.
+ * Descend the trie of the block's power of two by the bits of its size
+ * below the top one, and hang the block where the path ends, or in the
+ * ring of a node of the same size.
+ */
+static void tree_insert(struct arena *a, void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+	unsigned int bin = sc_log2(size);
+	size_t bits = size << (TREE_BINS - bin);
+	void *t = a->tree[bin];
+	void **link;
+
+	TREE_CHILD(bp, 0) = NULL;
+	TREE_CHILD(bp, 1) = NULL;
+	if (t == NULL){
+		a->tree[bin] = bp;
+		a->tree_map |= 1UL << bin;
+		TREE_PARENT(bp) = NULL;
+		TREE_NEXT(bp) = TREE_PREV(bp) = bp;
+		return;
+	}
+	while (GET_SIZE(HDRP(t)) != size){
+		link = &TREE_CHILD(t, bits >> (TREE_BINS - 1));
+		bits <<= 1;
+		if (*link == NULL){
+			*link = bp;
+			TREE_PARENT(bp) = t;
+			TREE_NEXT(bp) = TREE_PREV(bp) = bp;
+			return;
+		}
+		t = *link;
 	}
+	TREE_PARENT(bp) = TREE_RING;
+	TREE_NEXT(bp) = TREE_NEXT(t);
+	TREE_PREV(bp) = t;
+	TREE_PREV(TREE_NEXT(t)) = bp;
+	TREE_NEXT(t) = bp;
+}
 
-	else if (PREV_FRPT(bp) && !NEXT_FRPT(bp)){
-		NEXT_FRPT(PREV_FRPT(bp)) = NEXT_FRPT(bp);
-		PREV_FRPT(bp) = NULL;
+/* tree_remove
+ * para: free block of the top seg.
+ * Take the block out of its ring. A node that heads a ring hands its
+ * place in the trie to the next block of the ring; a node alone takes
+ * the deepest leaf below it in its place, which keeps the trie ordered
+ * since any node may stand for the subtree it heads.
+ */
+static void tree_remove(struct arena *a, void *bp)
+{
+	void *parent = TREE_PARENT(bp);
+	void *r, **link, **clink;
+	unsigned int bin;
+
+	if (TREE_NEXT(bp) != bp){
+		r = TREE_NEXT(bp);
+		TREE_PREV(r) = TREE_PREV(bp);
+		TREE_NEXT(TREE_PREV(bp)) = r;
+		if (parent == TREE_RING){
+			return;
+		}
+	}
+	else if ((r = *(link = &TREE_CHILD(bp, 1))) != NULL ||
+		(r = *(link = &TREE_CHILD(bp, 0))) != NULL){
+		while (*(clink = &TREE_CHILD(r, 1)) != NULL ||
+			*(clink = &TREE_CHILD(r, 0)) != NULL){
+			r = *(link = clink);
+		}
+		*link = NULL;
 	}
 
-	else if (!PREV_FRPT(bp) && NEXT_FRPT(bp)){
-		PREV_FRPT(NEXT_FRPT(bp)) = PREV_FRPT(bp);
-		NEXT_FRPT(bp) = NULL;
+	if (parent == NULL){
+		bin = sc_log2(GET_SIZE(HDRP(bp)));
+		if ((a->tree[bin] = r) == NULL){
+			a->tree_map &= ~(1UL << bin);
+		}
+	}
+	else if (TREE_CHILD(parent, 0) == bp){
+		TREE_CHILD(parent, 0) = r;
+	}
+	else {
+		TREE_CHILD(parent, 1) = r;
+	}
+	if (r != NULL){
+		TREE_PARENT(r) = parent;
+		for (int i = 0; i < 2; i++){
+			TREE_CHILD(r, i) = TREE_CHILD(bp, i);
+			if (TREE_CHILD(r, i) != NULL){
+				TREE_PARENT(TREE_CHILD(r, i)) = r;
+			}
+		}
 	}
 }
 
+/* tree_fit
+ * para: required size.
+ * Return the smallest block of the size tree that fits, or NULL.
+ * Descend the trie of the size's power of two along the size's bits,
+ * remembering the deepest right subtree left behind, which holds the
+ * next larger sizes; failing an exact fit, the best fit is the smaller
+ * of the best seen on the way and the smallest in that subtree or,
+ * if neither, in the next non-empty trie.
+ */
+static void *tree_fit(struct arena *a, size_t size)
+{
+	unsigned int bin = sc_log2(size);
+	size_t bits = size << (TREE_BINS - bin);
+	size_t rest = -size;	/* Bound the unsigned remainder of too small a block exceeds */
+	void *best = NULL, *t = a->tree[bin], *right = NULL, *rt;
+	unsigned long map;
+
+	while (t != NULL){
+		a->fit.nodes++;
+		if (GET_SIZE(HDRP(t)) - size < rest){
+			best = t;
+			if ((rest = GET_SIZE(HDRP(t)) - size) == 0){
+				return best;
+			}
+		}
+		rt = TREE_CHILD(t, 1);
+		t = TREE_CHILD(t, bits >> (TREE_BINS - 1));
+		if (rt != NULL && rt != t){
+			right = rt;
+		}
+		bits <<= 1;
+	}
+	t = right;
+	if (t == NULL && best == NULL){
+		map = a->tree_map & (~1UL << bin);
+		t = map ? a->tree[__builtin_ctzl(map)] : NULL;
+	}
+	for (; t != NULL;
+		t = TREE_CHILD(t, 0) ? TREE_CHILD(t, 0) : TREE_CHILD(t, 1)){
+		a->fit.nodes++;
+		if (GET_SIZE(HDRP(t)) - size < rest){
+			best = t;
+			rest = GET_SIZE(HDRP(t)) - size;
+		}
+	}
+	return best;
+}
 
 /* 
  * Based on different sizes allocte blocks.
@@ -525,34 +2187,207 @@ static void delete_block(void *bp)
  */
 static unsigned int get_list_number(size_t size)
 {
-	if (size <= SIZE0)
-		return 0;
-	else if (size <= SIZE1)
-		return 1;
-	else if (size <= SIZE2)
-		return 2;
-	else if (size <= SIZE3)
-		return 3;
-	else if (size <= SIZE4)
-		return 4;
-	else if (size <= SIZE5)
-		return 5;
-	else if (size <= SIZE6)
-		return 6;
-	else if (size <= SIZE7)
-		return 7;
-	else if (size <= SIZE8)
-		return 8;
-	else if (size <= SIZE9)
-		return 9;
-	else if (size <= SIZE10)
-		return 10;
-	else if (size <= SIZE11)
-		return 11;
-	else if (size <= SIZE12)
-		return 12;
-	else
-		return 13;
+	return size_class(&seg_classes, size);
+}
+
+/*
+ * mm_tcache_stats
+ * Copy the calling thread's cache counters into stats.
+ */
+void mm_tcache_stats(struct mm_tcache_stats *stats)
+{
+	*stats = tcache.stats;
+}
+
+/*
+ * mm_realloc_stats
+ * Copy the realloc counters into stats.
+ */
+void mm_realloc_stats(struct mm_realloc_stats *stats)
+{
+	*stats = realloc_stats;
+}
+
+/*
+ * mm_fit_policy
+ * Select the fit policy by name: "first", "bestof:<n>", "good" or
+ * "best". Return -1, keeping the old one, for an unknown name.
+ */
+int mm_fit_policy(const char *name)
+{
+	unsigned int n;
+
+	if (strcmp(name, "first") == 0){
+		fit_policy = FIT_FIRST;
+	}
+	else if (sscanf(name, "bestof:%u", &n) == 1 && n > 0){
+		fit_policy = FIT_BEST_OF;
+		fit_best_n = n;
+	}
+	else if (strcmp(name, "good") == 0){
+		fit_policy = FIT_GOOD;
+	}
+	else if (strcmp(name, "best") == 0){
+		fit_policy = FIT_BEST;
+	}
+	else {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * mm_free_order
+ * Select the free list order by name, from the next mm_init on:
+ * "lifo", "fifo" or "addr". Return -1 for an unknown name.
+ */
+int mm_free_order(const char *name)
+{
+	if (strcmp(name, "lifo") == 0){
+		next_order = ORDER_LIFO;
+	}
+	else if (strcmp(name, "fifo") == 0){
+		next_order = ORDER_FIFO;
+	}
+	else if (strcmp(name, "addr") == 0){
+		next_order = ORDER_ADDR;
+	}
+	else {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * mm_fit_stats
+ * Sum the find_fit counters over the arenas, including those of the
+ * heaps before the last mm_init. Read without the locks, so only
+ * approximate while other threads allocate.
+ */
+void mm_fit_stats(struct mm_fit_stats *stats)
+{
+	*stats = fit_stats;
+	for (int i = 0; i < MEM_ARENAS; i++){
+		stats->searches += arenas[i].fit.searches;
+		stats->nodes += arenas[i].fit.nodes;
+		stats->inserts += arenas[i].fit.inserts;
+		stats->steps += arenas[i].fit.steps;
+	}
+}
+
+/*
+ * mm_coalesce_stats
+ * Sum the merge, split and deferred free counters over the arenas,
+ * including those of the heaps before the last mm_init. Read without
+ * the locks, like mm_fit_stats.
+ */
+void mm_coalesce_stats(struct mm_coalesce_stats *stats)
+{
+	*stats = coalesce_stats;
+	for (int i = 0; i < MEM_ARENAS; i++){
+		stats->merges += arenas[i].coal.merges;
+		stats->splits += arenas[i].coal.splits;
+		stats->deferred += arenas[i].coal.deferred;
+		stats->reused += arenas[i].coal.reused;
+		stats->sweeps += arenas[i].coal.sweeps;
+	}
+}
+
+/*
+ * mm_frag_stats
+ * Walk the heap of every arena once, under its lock, and sort its bytes
+ * into blocks in use (run objects counted by size), freed blocks held
+ * in the calling thread's cache or on quick lists, idle run space, free
+ * blocks, by size and by seg, and the rest. Blocks in other threads'
+ * caches count as in use.
+ */
+void mm_frag_stats(struct mm_frag_stats *stats)
+{
+	struct arena *a;
+	struct slab_run *run;
+	struct huge_block *hb;
+	size_t size, walked, objects;
+	unsigned int k;
+	void *bp;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->segs = SEG_NUM;
+	for (int i = 0; i < SEG_NUM - 1; i++){
+		stats->seg_bound[i] = seg_bounds[i] * DSIZE;
+	}
+
+	for (int i = 0; i < MEM_ARENAS; i++){
+		a = &arenas[i];
+		if (a->heap_listp == NULL){
+			continue;
+		}
+		spin_lock(&a->lock);
+		walked = 0;
+		for (bp = a->heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)){
+			size = GET_SIZE(HDRP(bp));
+			walked += size;
+			if (!GET_ALLOC(HDRP(bp))){
+				stats->free_bytes += size;
+				stats->free_blocks++;
+				stats->largest_free = MAX(stats->largest_free, size);
+				k = sc_log2(size);
+				stats->free_hist[k]++;
+				stats->free_hist_bytes[k] += size;
+				k = get_list_number(size/DSIZE);
+				stats->seg_blocks[k]++;
+				stats->seg_bytes[k] += size;
+			}
+			else if ((run = slab_run_of(a, bp)) != NULL){
+				objects = run->used * (run->class + 1) * ALIGNMENT;
+				stats->used += objects;
+				stats->used_blocks += run->used;
+				stats->run_idle += size - objects;
+			}
+			else {
+				stats->used += size;
+				stats->used_blocks++;
+				stats->tags += DSIZE;
+			}
+		}
+		for (k = 0; k < QUICK_LISTS; k++){
+			for (bp = a->quick[k]; bp != NULL; bp = QUICK_NEXT(bp)){
+				stats->cached += k * ALIGNMENT;
+				stats->cached_blocks++;
+			}
+		}
+		for (k = 0; a == my_arena && tcache.gen == heap_gen &&
+			k < TCACHE_CLASSES; k++){
+			for (bp = tcache.entry[k]; bp != NULL; bp = TCACHE_NEXT(bp)){
+				stats->cached += GET_SIZE(HDRP(bp));
+				stats->cached_blocks++;
+			}
+		}
+		stats->heap += mem_arena_size(a->index);
+		stats->other += mem_arena_size(a->index) - walked;
+		spin_unlock(&a->lock);
+	}
+	/* Cached blocks were walked as blocks in use */
+	stats->used -= stats->cached;
+	stats->used_blocks -= stats->cached_blocks;
+	stats->tags -= stats->cached_blocks * DSIZE;
+
+	spin_lock(&huge_lock);
+	for (hb = huge_list; hb != NULL; hb = hb->next){
+		stats->heap += hb->size;
+		stats->used += hb->size;
+		stats->used_blocks++;
+		stats->tags += HUGE_OFFSET;
+	}
+	spin_unlock(&huge_lock);
+}
+
+/*
+ * mm_remote_stats
+ * Copy the remote free counters into stats.
+ */
+void mm_remote_stats(struct mm_remote_stats *stats)
+{
+	*stats = remote_stats;
 }
 
 /* Check functions */
@@ -569,17 +2404,37 @@ static unsigned int get_list_number(size_t size)
  * If lineno = 4, check if there is any block that is not coalesced right.
  * If lineno = 5, print allocated blocks.
  * If lineno = 6, check free lists, whether they are consistent, check total
- * number of free blocks.
+ * number of free blocks, and check seg_map against the seg entries.
+ * It also checks every partial slab run is mapped, of its list's class,
+ * and not full, and every huge block is mapped and linked right.
+ * Every arena whose heap is set up is checked in turn.
  */
 void mm_checkheap(int lineno) {
-	void *bp = heap_listp;
+	for (int i = 0; i < MEM_ARENAS; i++){
+		if (arenas[i].heap_listp != NULL){
+			check_arena(&arenas[i], lineno);
+		}
+	}
+	if (lineno == 6){
+		check_huge();
+	}
+}
+
+/*
+ * check_arena
+ * para: an arena, the mm_checkheap argument.
+ * Run the checks of mm_checkheap on the arena's heap.
+ */
+static void check_arena(struct arena *a, int lineno)
+{
+	void *bp = a->heap_listp;
 	if (lineno){
-		if ((GET_SIZE(HDRP(heap_listp))!=DSIZE)||
-			!GET_ALLOC(HDRP(heap_listp))){
+		if ((GET_SIZE(HDRP(a->heap_listp))!=DSIZE)||
+			!GET_ALLOC(HDRP(a->heap_listp))){
 	        printf("Prologue header error\n");
 	    }
-		for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)){
-			check_block(bp);
+		for (bp = a->heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)){
+			check_block(a, bp);
 		}
 		/* when bp is point to the end of the list, check epilogue */
 		if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))))
@@ -592,13 +2447,13 @@ void mm_checkheap(int lineno) {
 	if (lineno == 2){
 		for (int i = 1; i < SEG_NUM; i++){
 			printf("seg entry(%d): %p, max size: %d\n", 
-				i, SEG_ENTRY(seg_list, i), i * 16);
+				i, SEG_ENTRY(a->seg_list, i), i * 16);
 		}
 	}
 	/* Case 3, print every free block */
 	if (lineno == 3){
 		for (int i = 0; i < SEG_NUM; i++){
-			for(bp = SEG_ENTRY(seg_list, i); bp != NULL; bp = NEXT_FRPT(bp)){
+			for(bp = SEG_ENTRY(a->seg_list, i); bp != NULL; bp = NEXT_FRPT(bp)){
 				printf("block in seg %d\n", i);
 				print_block(bp);
 				if ((int)get_list_number(GET_SIZE(HDRP(bp))/DSIZE) != i){
@@ -611,7 +2466,7 @@ void mm_checkheap(int lineno) {
 	/* Case 4, Check if coalesce not work */
 	if (lineno == 4){
 		for(int i = 0; i < SEG_NUM; i++){
-			for(bp = SEG_ENTRY(seg_list, i); bp != NULL; bp = NEXT_FRPT(bp)){
+			for(bp = SEG_ENTRY(a->seg_list, i); bp != NULL; bp = NEXT_FRPT(bp)){
 				if(GET_ALLOC(HDRP(bp)) == 0 && NEXT_BLKP(bp)!=NULL 
 					&& GET_ALLOC(HDRP(NEXT_BLKP(bp))) ==0 ){
 					printf("Warn: Coalesce is not working!\n");
@@ -623,14 +2478,16 @@ void mm_checkheap(int lineno) {
 
 	/* Case 5, print every allocated block */
 	if (lineno == 5){
-		for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)){
+		for (bp = a->heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)){
 			print_block(bp);
 		}
 	}
 
 	/* Case 6, check free list */
 	if (lineno == 6){
-		check_free();
+		check_free(a);
+		check_runs(a);
+		check_quick(a);
 	}
 }
 
@@ -640,9 +2497,9 @@ void mm_checkheap(int lineno) {
  * para: bp, pointer of the current block.
  * Print out error information, return nothing.
  */
-static void check_block(void *bp)
+static void check_block(struct arena *a, void *bp)
 {
-	if (!in_heap(bp)){
+	if (!in_heap(a, bp)){
 		printf("(%p) Error: not in heap!!\n", bp);
 	}
 	if (!aligned(bp)){
@@ -667,7 +2524,8 @@ static void print_block(void *bp)
 	foot_size = GET_SIZE(FTRP(bp));
 	foot_alloc = GET_ALLOC(HDRP(bp));
 
-	if (head_size != foot_size || head_alloc != foot_alloc){
+	if ((head_size != foot_size && !GET_GROWTH(HDRP(bp))) ||
+		head_alloc != foot_alloc){
 		printf("Error! Header and Footer are different!\n");
 		return;
 	}
@@ -682,13 +2540,13 @@ static void print_block(void *bp)
  * Check if the number of free blocks in segregated list equals to
  * free blocks count from the start of the heap.
  */
-static void check_free()
+static void check_free(struct arena *a)
 {
 	unsigned int count_seg = 0;
 	unsigned int count_all = 0;
 	void *bp;
 
-	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+	for (bp = a->heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
 		if(!GET_ALLOC(HDRP(bp))) {
 			count_all++;
 		}
@@ -696,7 +2554,7 @@ static void check_free()
 
     for (int i = 0; i < SEG_NUM; i++)
     {
-        for (bp = SEG_ENTRY(seg_list, i); bp!=NULL
+        for (bp = SEG_ENTRY(a->seg_list, i); bp!=NULL
           && (GET_SIZE(HDRP(bp)) > 0);bp = NEXT_FRPT(bp)){
             count_seg++;
         }
@@ -706,8 +2564,40 @@ static void check_free()
     	return;
     }
 
+    if (FREE_TREE){
+        long count_tree = 0, tree = 0;
+
+        for (bp = SEG_ENTRY(a->seg_list, TREE_SEG); bp != NULL;
+             bp = NEXT_FRPT(bp)){
+            count_tree++;
+        }
+        for (unsigned int k = 0; k < TREE_BINS; k++){
+            if ((a->tree[k] != NULL) != ((a->tree_map >> k) & 1)){
+                printf("Tree map bit %u doesn't match tree!\n", k);
+                return;
+            }
+            if (a->tree[k] != NULL &&
+                (tree = check_tree(a->tree[k], NULL, 1, k)) < 0){
+                return;
+            }
+            count_tree -= tree;
+            tree = 0;
+        }
+        if (count_tree != 0){
+            printf("Size tree doesn't hold the top seg!\n");
+            return;
+        }
+    }
+
+    for (int i = 0; i < SEG_NUM; i++){
+        if ((SEG_ENTRY(a->seg_list, i) != NULL) != ((a->seg_map >> i) & 1)){
+            printf("Seg map bit %d doesn't match seg entry!\n", i);
+            return;
+        }
+    }
+
     for (int i = 0; i < SEG_NUM; i++){
-        for (bp = SEG_ENTRY(seg_list, i); bp!=NULL && (GET_SIZE(HDRP(bp))>0);
+        for (bp = SEG_ENTRY(a->seg_list, i); bp!=NULL && (GET_SIZE(HDRP(bp))>0);
         	bp = NEXT_FRPT(bp)){
             void *next = NEXT_FRPT(bp);
             void *prev = PREV_FRPT(bp);
@@ -721,16 +2611,151 @@ static void check_free()
                 printf("Next not match!\n");
                 return;
             }
+
+            if(next == NULL && a->seg_tail[i] != bp){
+                printf("Seg tail %d doesn't match last block!\n", i);
+                return;
+            }
+
+            if(free_order == ORDER_ADDR && next != NULL && next < bp){
+                printf("(%p) Seg %d out of address order!\n", bp, i);
+                return;
+            }
+
+            if(free_order == ORDER_ADDR &&
+               (prev == NULL || ADDR_SPAN_OF(a, prev) != ADDR_SPAN_OF(a, bp)) &&
+               addr_first[a->index][i][ADDR_SPAN_OF(a, bp)] != bp){
+                printf("(%p) Not the first of its span in seg %d!\n", bp, i);
+                return;
+            }
         } 
     }
 }
 
+/* check_tree
+ * para: tree node, its parent, the bits of size it stands for, and the
+ * shift that brings its size down to them.
+ * Check the node's subtree: sizes match the path to them, parents and
+ * rings link back, and ring members have the size of their node.
+ * Return the number of blocks in it, or -1 on error.
+ */
+static long check_tree(void *t, void *parent, size_t prefix,
+	unsigned int shift)
+{
+	size_t size = GET_SIZE(HDRP(t));
+	long count = 0, sub;
+	void *bp = t;
+
+	if ((size >> shift) != prefix || TREE_PARENT(t) != parent){
+		printf("(%p) Error: tree node of size %zu misplaced!\n", t, size);
+		return -1;
+	}
+	do {
+		if (TREE_PREV(TREE_NEXT(bp)) != bp || GET_SIZE(HDRP(bp)) != size ||
+			GET_ALLOC(HDRP(bp)) || (bp != t && TREE_PARENT(bp) != TREE_RING)){
+			printf("(%p) Error: bad ring of size %zu!\n", bp, size);
+			return -1;
+		}
+		count++;
+		bp = TREE_NEXT(bp);
+	} while (bp != t);
+	for (int i = 0; i < 2; i++){
+		if (TREE_CHILD(t, i) == NULL){
+			continue;
+		}
+		if (shift == 0 || (sub = check_tree(TREE_CHILD(t, i), t,
+			2 * prefix + i, shift - 1)) < 0){
+			return -1;
+		}
+		count += sub;
+	}
+	return count;
+}
+
+/* check_quick
+ * Check the quick lists: every block is in the heap, marked allocated
+ * and of its list's size, and their sizes add up to quick_bytes.
+ */
+static void check_quick(struct arena *a)
+{
+	size_t bytes = 0;
+	void *bp;
+
+	for (unsigned int i = 0; i < QUICK_LISTS; i++){
+		for (bp = a->quick[i]; bp != NULL; bp = QUICK_NEXT(bp)){
+			if (!in_heap(a, bp) || !GET_ALLOC(HDRP(bp)) ||
+				GET_SIZE(HDRP(bp)) != i * ALIGNMENT ||
+				GET(HDRP(bp)) != GET(FTRP(bp))){
+				printf("(%p) Error: bad block on quick list %u!\n", bp, i);
+				return;
+			}
+			bytes += i * ALIGNMENT;
+		}
+	}
+	if (bytes != a->quick_bytes){
+		printf("Quick lists hold %zu bytes, not %zu!\n", bytes,
+			a->quick_bytes);
+	}
+}
+
+/* check_runs
+ * Check the partial run lists: each run is in the run map, belongs to
+ * the class of its list, links back correctly and has room left.
+ */
+static void check_runs(struct arena *a)
+{
+	struct slab_run *run;
+
+	for (unsigned int i = 0; i < SLAB_CLASSES; i++){
+		for (run = a->slab_partial[i]; run != NULL; run = run->next){
+			if (slab_run_of(a, run) != run){
+				printf("(%p) Error: run not in run map!\n", run);
+				return;
+			}
+			if (run->class != i){
+				printf("(%p) Error: run of class %u in list %u!\n",
+					run, run->class, i);
+			}
+			if (run->next != NULL && run->next->prev != run){
+				printf("(%p) Error: run list prev not match!\n", run);
+			}
+			if (run->free == NULL &&
+				run->bump + (i + 1) * ALIGNMENT > RUN_SIZE - DSIZE){
+				printf("(%p) Error: full run in partial list!\n", run);
+			}
+		}
+	}
+}
+
+/* check_huge
+ * Check the huge list: each block lies outside the heap in a mapping
+ * of its recorded size, and links back correctly.
+ */
+static void check_huge(void)
+{
+	struct huge_block *hb;
+
+	for (hb = huge_list; hb != NULL; hb = hb->next){
+		if (!IS_HUGE((char *)hb + HUGE_OFFSET)){
+			printf("(%p) Error: huge block in heap!\n", hb);
+			return;
+		}
+		if (!mem_in_map(hb, hb->size)){
+			printf("(%p) Error: huge block not mapped!\n", hb);
+			return;
+		}
+		if (hb->next != NULL && hb->next->prev != hb){
+			printf("(%p) Error: huge list prev not match!\n", hb);
+		}
+	}
+}
+
 /*
  * Return whether the pointer is in the heap.
  * May be useful for debugging.
  */
-static int in_heap(const void *p) {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
+static int in_heap(struct arena *a, const void *p) {
+    return p <= mem_arena_hi(a->index) && (const char *)p >= a->lo;
 }
 
 /*
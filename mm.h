@@ -22,3 +22,95 @@ extern int mm_init(void);
 
 /* This is largely for debugging. */
 extern void mm_checkheap(int lineno);
+
+/* Nonzero if several threads may call the package at once (mm.c). */
+extern const int mm_thread_safe;
+
+/* Give free memory back to the system, return the bytes given back
+ * (mm.c). */
+extern size_t mm_trim(void);
+
+/* Thread-cache counters of the calling thread (mm.c only). */
+struct mm_tcache_stats {
+	unsigned long hits;		/* mallocs served from the thread cache */
+	unsigned long misses;	/* small mallocs that went to the seg lists */
+	unsigned long flushes;	/* batches returned to the seg lists */
+	unsigned long refills;	/* blocks prefetched from the seg lists */
+};
+extern void mm_tcache_stats(struct mm_tcache_stats *stats);
+
+/* Realloc counters (mm.c and mm_nofooter.c). */
+struct mm_realloc_stats {
+	unsigned long in_place;	/* kept or shrunk in place, no copy */
+	unsigned long grow_next;	/* grown into the next free block, no copy */
+	unsigned long grow_tail;	/* grown by extending the heap, no copy */
+	unsigned long grow_prev;	/* slid back into the previous free block */
+	unsigned long remap;	/* mapped block resized with mem_remap, no copy */
+	unsigned long copies;	/* moved with malloc, memcpy and free */
+	unsigned long headroom;	/* grown into headroom left by a past realloc */
+	unsigned long copy_bytes;	/* payload bytes copied or slid back */
+	unsigned long saved_bytes;	/* payload bytes headroom saved copying */
+	unsigned long headroom_bytes;	/* spare bytes handed out as headroom */
+};
+extern void mm_realloc_stats(struct mm_realloc_stats *stats);
+
+/* Cross-thread free counters, summed over the arenas (mm.c). */
+struct mm_remote_stats {
+	unsigned long frees;	/* blocks queued by a thread of another arena */
+	unsigned long bytes;	/* their size in bytes */
+	unsigned long drains;	/* queues emptied by the owning arena */
+	unsigned long drained;	/* blocks freed from the queues */
+};
+extern void mm_remote_stats(struct mm_remote_stats *stats);
+
+/* Fit policy of the seg lists (mm.c): "first", "bestof:<n>", "good"
+ * or "best". Returns -1 for an unknown policy. */
+extern int mm_fit_policy(const char *name);
+
+/* Free list order of the seg lists (mm.c), from the next mm_init on:
+ * "lifo", "fifo" or "addr". Returns -1 for an unknown order. */
+extern int mm_free_order(const char *name);
+
+/* Fit search and free list counters, summed over the arenas (mm.c). */
+struct mm_fit_stats {
+	unsigned long searches;	/* seg list searches for a free block */
+	unsigned long nodes;	/* free blocks visited by them */
+	unsigned long inserts;	/* free blocks linked into a seg list */
+	unsigned long steps;	/* blocks stepped over to find their place */
+};
+extern void mm_fit_stats(struct mm_fit_stats *stats);
+
+/* Coalescing counters, summed over the arenas (mm.c). */
+struct mm_coalesce_stats {
+	unsigned long merges;	/* free blocks merged with a neighbour */
+	unsigned long splits;	/* free blocks split to serve a malloc */
+	unsigned long deferred;	/* frees put on a quick list, not coalesced */
+	unsigned long reused;	/* mallocs served from a quick list as is */
+	unsigned long sweeps;	/* quick list sweeps */
+};
+extern void mm_coalesce_stats(struct mm_coalesce_stats *stats);
+
+/* Where the bytes of the heap are, from one walk of it (mm.c). Heap
+ * bytes = used + cached + run_idle + free_bytes + other. */
+#define MM_FRAG_BINS	64	/* free blocks by floor(log2(size)) */
+#define MM_FRAG_SEGS	64	/* free blocks by seg list */
+struct mm_frag_stats {
+	size_t heap;		/* bytes of every arena, plus mapped blocks */
+	size_t used;		/* bytes of the blocks and run objects in use */
+	unsigned long used_blocks;
+	size_t tags;		/* of those, header and footer bytes */
+	size_t cached;		/* freed blocks held back, still marked allocated */
+	unsigned long cached_blocks;
+	size_t run_idle;	/* bytes of slab runs outside a live object */
+	size_t free_bytes;	/* bytes of free blocks */
+	unsigned long free_blocks;
+	size_t largest_free;
+	size_t other;		/* seg list heads, prologues and epilogues */
+	unsigned long free_hist[MM_FRAG_BINS];	/* 2^k to 2^(k+1)-1 bytes */
+	size_t free_hist_bytes[MM_FRAG_BINS];
+	unsigned int segs;
+	size_t seg_bound[MM_FRAG_SEGS];	/* largest block of a seg, 0 if none */
+	unsigned long seg_blocks[MM_FRAG_SEGS];
+	size_t seg_bytes[MM_FRAG_SEGS];
+};
+extern void mm_frag_stats(struct mm_frag_stats *stats);
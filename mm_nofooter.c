@@ -1,8 +1,27 @@
 /*
- * mm.c
- *
- * NOTE TO STUDENTS: Replace this header comment with your own header
- * comment that gives a high level description of your solution.
+ * mm_nofooter.c
+ * Segregated free lists and first fit, like mm.c, but allocated blocks
+ * carry only a header: footers are kept on free blocks alone.
+ * Instead of reading the previous block's footer, a block knows from
+ * bit 1 of its own header whether the block before it is allocated.
+ * That bit is kept up to date for the successor on every place, free,
+ * coalesce and realloc, so coalesce only follows the previous footer
+ * when the previous block is free and therefore has one.
+ * Free blocks link to each other by 32-bit offsets from the start of
+ * the heap rather than by pointers, so the smallest block is 16 bytes:
+ * header, two links and footer. An allocated block costs its payload
+ * plus a 4-byte header.
+ * realloc shrinks in place and grows in place into a free next block,
+ * at the end of the heap or back into a free previous block, before
+ * falling back to malloc, copy and free.
+ * Data structures are:
+ * Allocated                      Free
+ *   [Header: size, p, 1]         [Header: size, p, 0]
+ *   [....Payload....]            [Offset of PrevFRBK]
+ *   [....Payload....]            [Offset of NextFRBK]
+ *                                [ ............. ]
+ *                                [Footer: size, p, 0]
+ * p is the prev-alloc bit.
  */
 #include <assert.h>
 #include <stdio.h>
@@ -12,6 +31,7 @@
 
 #include "mm.h"
 #include "memlib.h"
+#include "sizeclass.h"
 
 /* If you want debugging output, use the following macro.  When you hand
  * in, remove the #define DEBUG line. */
@@ -42,63 +62,94 @@
 #define WSIZE       4       /* Word and header/footer size (bytes) */
 #define DSIZE       8       /* Double word size (bytes) */
 #define CHUNKSIZE   168		/* Extend heap by this amount (bytes) */
-#define MINIMUM		16		/* Minimum block size head + foot = 8, prev + next = 16. */
+#define MINIMUM		16		/* Minimum block size head + foot = 8,
+                               prev + next offsets = 8. Total 16(bytes).*/
 
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))
 
-/* Pack a size and allocated bit into a word */
-#define PACK(size, alloc, prev_alloc)  ((size) | (alloc) | (prev_alloc))
+/* Pack a size, allocated bit and prev-alloc bit into a word */
+#define PACK(size, alloc, prev_alloc)  ((size) | (alloc) | ((prev_alloc) << 1))
 
 /* Read and write a word at address p */
 #define GET(p)       (*(unsigned int *)(p))
 #define PUT(p, val)  (*(unsigned int *)(p) = (val))
 
-/* Read the size and allocated fields from address p */
+/* Read the size, allocated and prev-alloc fields from address p */
 #define GET_SIZE(p)  (GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x1)
-#define GET_PREV_ALLOC(p)	(GET(p) & 0x2) /* second bit store previous be allocated */
-	
+#define GET_PREV_ALLOC(p)	((GET(p) >> 1) & 0x1) /* previous block allocated */
 
-/* Given block ptr bp,compute address of its header and footer */
+/* Set or clear the prev-alloc bit in the header of block bp */
+#define SET_PREV_ALLOC(bp)	PUT(HDRP(bp), GET(HDRP(bp)) | 0x2)
+#define CLR_PREV_ALLOC(bp)	PUT(HDRP(bp), GET(HDRP(bp)) & ~0x2)
+
+/* Given block ptr bp,compute address of its header and footer.
+ * Only free blocks have a footer. */
 #define HDRP(bp) ((void *)(bp) - WSIZE)
 #define FTRP(bp) ((void *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp,compute address of next and previous blocks */
-#define NEXT_BLKP(bp) ((void *)(bp) + GET_SIZE(HDRP(bp))) 
+/* Given block ptr bp,compute address of next and previous blocks.
+ * PREV_BLKP is only valid when the previous block is free. */
+#define NEXT_BLKP(bp) ((void *)(bp) + GET_SIZE(HDRP(bp)))
 #define PREV_BLKP(bp) ((void *)(bp) - GET_SIZE(HDRP(bp) - WSIZE))
 
-/* Given block ptr bp, compute address of next and previous free blocks */
-#define NEXT_FRPT(bp) (*(void **)(bp + DSIZE))
-#define PREV_FRPT(bp) (*(void **)(bp))
+/* Free list links are offsets from heap_base, 0 standing for NULL */
+#define TO_OFFSET(p)	((p) ? (unsigned int)((char *)(p) - heap_base) : 0)
+#define TO_BLOCK(off)	((off) ? (void *)(heap_base + (off)) : NULL)
 
-#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
-#define SIZE_PTR(p)  ((size_t*)(((char*)(p)) - SIZE_T_SIZE))
+/* Given block ptr bp, get or set its previous and next free blocks */
+#define PREV_FRPT(bp)	TO_BLOCK(GET(bp))
+#define NEXT_FRPT(bp)	TO_BLOCK(GET((char *)(bp) + WSIZE))
+#define SET_PREV_FRPT(bp, p)	PUT(bp, TO_OFFSET(p))
+#define SET_NEXT_FRPT(bp, p)	PUT((char *)(bp) + WSIZE, TO_OFFSET(p))
 
 /* Get the enrty pointer in seg list*/
 #define SEG_ENTRY(seg_list, i)		(*(void **)(seg_list + i * DSIZE))
-#define SEG_NUM		14
+#define SEG_NUM		((int)(sizeof(seg_bounds) / sizeof(seg_bounds[0])) + 1)
+
+/* Seg list upper bounds in bytes; override with -DSEG_BOUNDS=... */
+#ifndef SEG_BOUNDS
+#define SEG_BOUNDS	16, 24, 32, 48, 64, 128, 256, 512, 1024, 2048, 4096, 8192
+#endif
+static const size_t seg_bounds[] = { SEG_BOUNDS };
 
-static void *coalease(void *ptr);
+/*** Declaration ***/
+static void *coalesce(void *ptr);
 static void *extend_heap(size_t words);
 static void *find_fit(size_t size);
 static void place(void *bp, size_t size);
+static void split_free(void *bp, size_t size, size_t asize);
+static void *grow_block(void *ptr, size_t asize);
 static void delete_block(void *bp);
-static void *add_block(void *bp);
+static void add_block(void *bp);
 static unsigned int get_list_number(size_t size);
-static void check_bloack(void *bp);
+static void check_block(int lineno, void *bp, int prev_alloc);
+static void check_free(int lineno);
 static void print_block(void *bp);
+static int in_heap(const void *p);
+static int aligned(const void *p);
+/*** Declaration End ***/
 
-
+/* Global Variables: seg_list, heap_listp, heap_base */
 static char *seg_list = 0; /* Pointer to first seg */
 static char *heap_listp = 0;
+static char *heap_base = 0; /* Start of the heap, base of the links */
+static struct size_classes seg_classes; /* Lookup tables for seg_bounds */
+static unsigned long seg_map = 0; /* Bit i set iff seg entry i is non-empty */
+static struct mm_realloc_stats realloc_stats;
+
 
+/* Malloc Routine: init, malloc, free, realloc, calloc */
 /*
+ * mm_init
  * Initialize: return -1 on error, 0 on success.
+ * Initialize segregated list first, every entry NULL.
+ * Then set prologue header, footer and Epilogue head for the heap.
  */
 int mm_init(void) {
-	heap_listp = NULL;
-	seg_list = NULL;
+	sizeclass_init(&seg_classes, seg_bounds, SEG_NUM - 1);
+	heap_base = mem_heap_lo();
 
 	/* Initialize seg list frist */
 	if ((seg_list = mem_sbrk(SEG_NUM * DSIZE)) == NULL){
@@ -108,6 +159,7 @@ int mm_init(void) {
 	for (int i = 0; i < SEG_NUM; i++){
 		SEG_ENTRY(seg_list, i) = NULL;
 	}
+	seg_map = 0;
 
 	/* Create the initial empty heap */
 	if ((heap_listp = mem_sbrk(4 * WSIZE)) == NULL){
@@ -120,21 +172,21 @@ int mm_init(void) {
 
 	heap_listp += (2*WSIZE);
 
-
-	//free_listp = heap_listp + DSIZE;
 	/* Extend the empty heap with a free block of CHUNKSIZE bytes */
 	if (extend_heap(CHUNKSIZE/WSIZE) == NULL){
 		return -1;
 	}
-    return 0;
+	return 0;
 }
 
 
 /*
  * malloc
+ * Align the block size, a header plus the payload, at least MINIMUM.
+ * Take the first fit from the seg lists, extending the heap if there
+ * is none.
  */
 void *malloc (size_t size) {
-	//mm_checkheap(2);
 	size_t asize; /* Adjusted block size */
 	size_t extendsize; /* Amount to extend heap if not fit */
 	char *bp;
@@ -147,27 +199,25 @@ void *malloc (size_t size) {
 		return NULL;
 	}
 
-	asize = MAX(ALIGN(size + DSIZE), MINIMUM);
+	asize = MAX(ALIGN(size + WSIZE), MINIMUM);
 
 	/* find if there is a free block to allocate */
-	if ((bp = find_fit(asize))) {
-		place(bp, asize);
-		return bp;
-	}
-	/* If free block does not exist, extend the heap */
-	else if ((bp = find_fit(asize))== NULL) {
+	if ((bp = find_fit(asize)) == NULL){
+		/* If free block does not exist, extend the heap */
 		extendsize = MAX(asize, CHUNKSIZE);
 		if ((bp = extend_heap(extendsize/WSIZE)) == NULL){
 			return NULL;
 		}
-		place(bp, asize);
 	}
-
+	place(bp, asize);
 	return bp;
 }
 
 /*
  * free
+ * Clear the allocated bit, write the footer the free block now needs
+ * and tell the next block its predecessor is free. Then coalesce and
+ * add the block to its seg list.
  */
 void free (void *ptr) {
 	if (ptr == 0){
@@ -180,22 +230,22 @@ void free (void *ptr) {
 		mm_init();
 	}
 
-	size_t alloc = GET_PREV_ALLOC(ptr);
-	PUT(HDRP(ptr), PACK(size, 0, alloc));
-
+	PUT(HDRP(ptr), PACK(size, 0, GET_PREV_ALLOC(HDRP(ptr))));
+	PUT(FTRP(ptr), GET(HDRP(ptr)));
+	CLR_PREV_ALLOC(NEXT_BLKP(ptr));
 
-	//PUT(FTRP(ptr), PACK(size, 0));
-
-	ptr = coalease(ptr);
-	ptr = add_block(ptr);	
+	add_block(coalesce(ptr));
 }
 
 /*
- * realloc - you may want to look at mm-naive.c
+ * realloc
+ * Shrink in place, splitting off the tail when it can hold a block.
+ * Grow in place if possible (see grow_block), otherwise malloc a new
+ * block, copy and free the old one.
  */
-void *realloc(void *oldptr, size_t size) 
+void *realloc(void *oldptr, size_t size)
 {
-	size_t oldsize;
+	size_t oldsize, asize;
 	void *newptr;
 
 	/* If size == 0 then this is just free, and we return NULL. */
@@ -209,6 +259,17 @@ void *realloc(void *oldptr, size_t size)
 		return malloc(size);
 	}
 
+	asize = MAX(ALIGN(size + WSIZE), MINIMUM);
+	oldsize = GET_SIZE(HDRP(oldptr));
+	if (asize <= oldsize){
+		realloc_stats.in_place++;
+		split_free(oldptr, oldsize, asize);
+		return oldptr;
+	}
+	if ((newptr = grow_block(oldptr, asize)) != NULL){
+		return newptr;
+	}
+
 	newptr = malloc(size);
 
 	/* If realloc() fails the original block is left untouched  */
@@ -217,11 +278,13 @@ void *realloc(void *oldptr, size_t size)
 	}
 
 	/* Copy the old data. */
-	oldsize = *SIZE_PTR(oldptr);
+	oldsize -= WSIZE;
 	if(size < oldsize){
 		oldsize = size;
 	}
 	memcpy(newptr, oldptr, oldsize);
+	realloc_stats.copies++;
+	realloc_stats.copy_bytes += oldsize;
 
 	/* Free the old block. */
 	free(oldptr);
@@ -231,7 +294,7 @@ void *realloc(void *oldptr, size_t size)
 }
 
 /*
- * calloc - you may want to look at mm-naive.c
+ * calloc
  * This function is not tested by mdriver, but it is
  * needed to run the traces.
  */
@@ -240,282 +303,396 @@ void *calloc (size_t nmemb, size_t size) {
 	void *newptr;
 
 	newptr = malloc(bytes);
-	memset(newptr, 0, bytes);
+	if (newptr != NULL){
+		memset(newptr, 0, bytes);
+	}
 
 	return newptr;
 }
 
 
-/*
- * Return whether the pointer is in the heap.
- * May be useful for debugging.
- */
-static int in_heap(const void *p) {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
-}
-
-/*
- * Return whether the pointer is aligned.
- * May be useful for debugging.
+/* Helper functions: Coalesce, extend, find fit, place, split, grow,
+ *			   add block, delete block, get seg number.
  */
-static int aligned(const void *p) {
-    return (size_t)ALIGN(p) == (size_t)p;
-}
 
-/*
- * mm_checkheap
+/* coalesce
+ * para: pointer to a free block, header and footer written.
+ * Merge it with a free previous block, found through that block's
+ * footer, and with a free next block. The merged block keeps the
+ * prev-alloc bit of its first block.
  */
-void mm_checkheap(int lineno) {
-	void *bp = heap_listp;
-	if (lineno){
-		printf("Heap %p: \n", heap_listp);
-		for (int i = 1; i < SEG_NUM; i ++){
-			printf("seg entry(%d): %p, max size: %d\n", i, SEG_ENTRY(seg_list, i), i * 16);
-		}
-		check_bloack(bp);
-	}
-	if (lineno == 2){
-		for(bp = heap_listp; GET_SIZE(HDRP(bp))> 0; bp = NEXT_BLKP(bp)){
-			print_block(bp);
-		}
-	}
-}
-
-/* Helper functions */
-static void *coalease(void *ptr) {
-	//size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(ptr)));
-	size_t prev_alloc = GET_PREV_ALLOC(ptr);
+static void *coalesce(void *ptr) {
+	size_t prev_alloc = GET_PREV_ALLOC(HDRP(ptr));
 	size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
 	size_t size = GET_SIZE(HDRP(ptr));
 
 	if (prev_alloc && next_alloc) {
+		/* pre block and next block both been allocated */
 		return ptr;
 	}
 
-	if (prev_alloc && !next_alloc){
+	if (!next_alloc){
 		/* next block not allocated */
 		size += GET_SIZE(HDRP(NEXT_BLKP(ptr)));
 		delete_block(NEXT_BLKP(ptr));
-		PUT(HDRP(ptr), PACK(size, 0, 1));
-		//PUT(FTRP(ptr), PACK(size, 0));
 	}
 
-	else if (!prev_alloc && next_alloc){
+	if (!prev_alloc){
 		/* previous block not allocated */
 		ptr = PREV_BLKP(ptr);
-		size_t alloc = GET_PREV_ALLOC(ptr);
 		size += GET_SIZE(HDRP(ptr));
-		printf("\nPrev block allocated %d\n", GET_PREV_ALLOC(PREV_BLKP(ptr)));
-		printf("current block head %p", HDRP(ptr));
 		delete_block(ptr);
-		PUT(HDRP(ptr), PACK(size, 0, alloc));
-		//PUT(FTRP(ptr), PACK(size, 0));
-	}
-
-	else if(!prev_alloc && !next_alloc){
-		/* Both block not allocated */
-		size = size + GET_SIZE(HDRP(PREV_BLKP(ptr))) + GET_SIZE(FTRP(NEXT_BLKP(ptr)));
-		delete_block(PREV_BLKP(ptr));
-		delete_block(NEXT_BLKP(ptr));
-		size_t alloc = GET_PREV_ALLOC(PREV_BLKP(ptr));
-		PUT(HDRP(PREV_BLKP(ptr)), PACK(size, 0, alloc));
-		ptr = PREV_BLKP(ptr);
 	}
 
+	PUT(HDRP(ptr), PACK(size, 0, GET_PREV_ALLOC(HDRP(ptr))));
+	PUT(FTRP(ptr), GET(HDRP(ptr)));
 	return ptr;
 }
 
+/* extend_heap
+ * Grow the heap by an even number of words. The old epilogue becomes
+ * the header of the new free block and keeps its prev-alloc bit.
+ * Write a new epilogue, coalesce and add the block to its seg list.
+ */
 static void *extend_heap(size_t words)
 {
 	char *bp;
 	size_t size;
 	/* Allocate an even number of words to maintain alignment */
 	size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
-	//if (size < MINIMUM){
-	//	size = MINIMUM;
-	//}
+	if (size < MINIMUM){
+		size = MINIMUM;
+	}
 	if ((long)(bp = mem_sbrk(size)) == -1){
 		return NULL;
 	}
- 
+
 	/* Initialize free block header/footer and the epilogue header */
-	PUT(HDRP(bp), PACK(size, 0, 1)); /* Free block header */
-	//PUT(FTRP(bp), PACK(size, 0)); /* Free block footer */
-	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1, 1)); /* New epilogue header */
+	PUT(HDRP(bp), PACK(size, 0, GET_PREV_ALLOC(HDRP(bp))));
+	PUT(FTRP(bp), GET(HDRP(bp)));
+	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1, 0)); /* New epilogue header */
 
-	bp = coalease(bp);
-	bp = add_block(bp);
-	/* Coalease if the previous block was free */
+	bp = coalesce(bp);
+	add_block(bp);
 	return bp;
 }
 
+/* find fit
+ * para: required block size.
+ * First fit, from the seg list of this size up to the largest one,
+ * visiting only the non-empty ones.
+ */
 static void *find_fit(size_t size)
 {
 	void *bp;
-	unsigned int entry_num = get_list_number(size);
+	unsigned int i;
+	unsigned long map = seg_map & (~0UL << get_list_number(size));
 
-	for (int i = entry_num; i < SEG_NUM; i++){
-		for (bp = SEG_ENTRY(seg_list, i); (bp != NULL) && GET_SIZE(HDRP(bp)) > 0; bp = NEXT_FRPT(bp)){
+	while (map){
+		i = __builtin_ctzl(map);
+		for (bp = SEG_ENTRY(seg_list, i); bp != NULL; bp = NEXT_FRPT(bp)){
 			if (size <= (size_t)GET_SIZE(HDRP(bp))){
 				return bp;
 			}
 		}
+		map &= map - 1;
 	}
 	return NULL;
 }
 
-/* Place block at begining of a free block. Split if 
- * remaining block is larger than minimum size
+/* place
+ * para: free block bp, block size.
+ * Allocate asize bytes at the start of the free block and mark the
+ * next block's predecessor allocated; split_free frees the rest if it
+ * is at least MINIMUM.
  */
 static void place(void *bp, size_t asize)
 {
-	/* 
-	 *Get the size of the allocated block 
-	 * Decide whether to split the block
-	 */
 	size_t csize = GET_SIZE(HDRP(bp));
 
-	if ((csize - asize) >= MINIMUM){
-		/* Split */
-		delete_block(bp);
-		size_t alloc = GET_PREV_ALLOC(bp);
-		PUT(HDRP(bp), PACK(asize, 1, alloc));
-		//PUT(FTRP(bp), PACK(asize, 1));
-		bp = NEXT_BLKP(bp);
-		PUT(HDRP(bp), PACK(csize - asize, 0, 1));
-		//PUT(FTRP(bp), PACK(csize - asize, 0));
-		bp = coalease(bp);
-		bp = add_block(bp);
+	delete_block(bp);
+	PUT(HDRP(bp), PACK(csize, 1, GET_PREV_ALLOC(HDRP(bp))));
+	SET_PREV_ALLOC(NEXT_BLKP(bp));
+	split_free(bp, csize, asize);
+}
+
+/* split_free
+ * para: allocated block bp of size bytes, size to keep.
+ * If the tail past asize can hold a block, shrink bp to asize, free
+ * the tail and coalesce it with a free next block.
+ */
+static void split_free(void *bp, size_t size, size_t asize)
+{
+	void *next;
+
+	if (size - asize < MINIMUM){
+		return;
+	}
+	PUT(HDRP(bp), PACK(asize, 1, GET_PREV_ALLOC(HDRP(bp))));
+	next = NEXT_BLKP(bp);
+	PUT(HDRP(next), PACK(size - asize, 0, 1));
+	PUT(FTRP(next), GET(HDRP(next)));
+	CLR_PREV_ALLOC(NEXT_BLKP(next));
+	add_block(coalesce(next));
+}
+
+/* grow_block
+ * para: allocated block ptr, block size larger than it.
+ * Grow the block without moving its payload: into the next block if it
+ * is free and big enough, or by extending the heap when the block, or
+ * the free block after it, is the last one. Failing that, if the free
+ * previous block (with the free next block) makes room, slide the
+ * payload back into it. Any tail of MINIMUM bytes or more is freed.
+ * Return the block, or NULL if none of these fit.
+ */
+static void *grow_block(void *ptr, size_t asize)
+{
+	size_t size = GET_SIZE(HDRP(ptr));
+	size_t prev_alloc = GET_PREV_ALLOC(HDRP(ptr));
+	void *next = NEXT_BLKP(ptr);
+	void *prev;
+	size_t next_size = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+	size_t prev_size = prev_alloc ? 0 : GET_SIZE(HDRP(ptr) - WSIZE);
+
+	if (size + next_size >= asize){
+		realloc_stats.grow_next++;
+	}
+	else if (GET_SIZE(HDRP(next_size ? NEXT_BLKP(next) : next)) == 0){
+		/* Last block: the new free block coalesces with a free next */
+		if (extend_heap((asize - size - next_size) / WSIZE) == NULL){
+			return NULL;
+		}
+		next_size = GET_SIZE(HDRP(next));
+		realloc_stats.grow_tail++;
+	}
+	else if (prev_size + size + next_size >= asize){
+		prev = PREV_BLKP(ptr);
+		prev_alloc = GET_PREV_ALLOC(HDRP(prev));
+		delete_block(prev);
+		memmove(prev, ptr, size - WSIZE);
+		realloc_stats.copy_bytes += size - WSIZE;
+		size += prev_size;
+		ptr = prev;
+		realloc_stats.grow_prev++;
 	}
 	else {
-		/* Allocate entire block */
-		delete_block(bp);
-		size_t alloc = GET_PREV_ALLOC(bp);
-		PUT(HDRP(bp), PACK(csize, 1, alloc));
-		//PUT(FTRP(bp), PACK(csize, 1));
+		return NULL;
 	}
+
+	if (next_size){
+		delete_block(next);
+		size += next_size;
+	}
+	PUT(HDRP(ptr), PACK(size, 1, prev_alloc));
+	SET_PREV_ALLOC(NEXT_BLKP(ptr));
+	split_free(ptr, size, asize);
+	return ptr;
 }
 
-static void *add_block(void *bp)
+/* add_block
+ * para: pointer to a coalesced free block
+ * LIFO, push the block on the seg list of its size.
+ */
+static void add_block(void *bp)
 {
-	/* Coalease first then allocate to seg list */
-	//bp = coalease(bp);
+	unsigned int seg_number = get_list_number(GET_SIZE(HDRP(bp)));
+	void *head = SEG_ENTRY(seg_list, seg_number);
 
-	int size = GET_SIZE(HDRP(bp));
-	unsigned int seg_number = get_list_number(size);
-
-	if (SEG_ENTRY(seg_list, seg_number) == NULL){
-		NEXT_FRPT(bp) = NULL;
-		PREV_FRPT(bp) = NULL;
-	}
-	else if (SEG_ENTRY(seg_list, seg_number)){
-		NEXT_FRPT(bp) = SEG_ENTRY(seg_list, seg_number);
-		PREV_FRPT(bp) = NULL;
-		PREV_FRPT(SEG_ENTRY(seg_list, seg_number)) = bp;
+	SET_PREV_FRPT(bp, NULL);
+	SET_NEXT_FRPT(bp, head);
+	if (head != NULL){
+		SET_PREV_FRPT(head, bp);
 	}
 	SEG_ENTRY(seg_list, seg_number) = bp;
-
-	return bp;
+	seg_map |= 1UL << seg_number;
 }
 
+/* delete_block
+ * para: pointer to a free block
+ * Unlink the block from its seg list.
+ */
 static void delete_block(void *bp)
 {
-	int size = GET_SIZE(HDRP(bp));
-	unsigned int seg_number = get_list_number(size);
+	unsigned int seg_number = get_list_number(GET_SIZE(HDRP(bp)));
+	void *prev = PREV_FRPT(bp);
+	void *next = NEXT_FRPT(bp);
 
-	if (bp == SEG_ENTRY(seg_list, seg_number))
-	{
-		SEG_ENTRY(seg_list, seg_number) = NEXT_FRPT(bp);
+	if (next != NULL){
+		SET_PREV_FRPT(next, prev);
 	}
-
-	if (PREV_FRPT(bp) && NEXT_FRPT(bp)){
-		NEXT_FRPT(PREV_FRPT(bp)) = NEXT_FRPT(bp);
-		PREV_FRPT(NEXT_FRPT(bp)) = PREV_FRPT(bp);
-		PREV_FRPT(bp) = NULL;
-		NEXT_FRPT(bp) = NULL;
+	if (prev != NULL){
+		SET_NEXT_FRPT(prev, next);
+	}
+	else {
+		SEG_ENTRY(seg_list, seg_number) = next;
+		if (next == NULL){
+			seg_map &= ~(1UL << seg_number);
+		}
 	}
+}
+
+/*
+ * Get the seg list of a block.
+ * para: size = block size in bytes.
+ */
+static unsigned int get_list_number(size_t size)
+{
+	return size_class(&seg_classes, size);
+}
+
+/*
+ * mm_realloc_stats
+ * Copy the realloc counters into stats.
+ */
+void mm_realloc_stats(struct mm_realloc_stats *stats)
+{
+	*stats = realloc_stats;
+}
+
+
+/* Check functions */
+/*
+ * mm_checkheap
+ * Call checkheap with non zero numbers, e.g. __LINE__ of the caller,
+ * which is printed with every error.
+ * Check Prologue and Epilogue, then walk the heap: every block is in
+ * the heap and aligned, its prev-alloc bit matches the block before
+ * it, free blocks have a matching footer and are coalesced. Then check
+ * the seg lists. If lineno = 2, also print every block.
+ */
+void mm_checkheap(int lineno) {
+	void *bp;
+	int prev_alloc = 1;
 
-	else if (PREV_FRPT(bp) && !NEXT_FRPT(bp)){
-		NEXT_FRPT(PREV_FRPT(bp)) = NEXT_FRPT(bp);
-		PREV_FRPT(bp) = NULL;
+	if (!lineno){
+		return;
 	}
 
-	else if (!PREV_FRPT(bp) && NEXT_FRPT(bp)){
-		PREV_FRPT(NEXT_FRPT(bp)) = PREV_FRPT(bp);
-		NEXT_FRPT(bp) = NULL;
+	if ((GET_SIZE(HDRP(heap_listp)) != DSIZE) ||
+		!GET_ALLOC(HDRP(heap_listp))){
+		printf("(%d) Prologue header error\n", lineno);
 	}
+	for (bp = NEXT_BLKP(heap_listp); GET_SIZE(HDRP(bp)) > 0;
+		bp = NEXT_BLKP(bp)){
+		if (lineno == 2){
+			print_block(bp);
+		}
+		check_block(lineno, bp, prev_alloc);
+		prev_alloc = GET_ALLOC(HDRP(bp));
+	}
+	/* when bp is point to the end of the list, check epilogue */
+	if (!GET_ALLOC(HDRP(bp)) || (int)GET_PREV_ALLOC(HDRP(bp)) != prev_alloc){
+		printf("(%d) Epilogue header error\n", lineno);
+	}
+
+	check_free(lineno);
 }
 
-static void check_bloack(void *bp)
+/*
+ * Block checks: the block is in the heap and aligned, its prev-alloc
+ * bit says prev_alloc, and if it is free its footer matches the header
+ * and it has no free neighbour.
+ * para: lineno of the caller, bp, allocated bit of the previous block.
+ */
+static void check_block(int lineno, void *bp, int prev_alloc)
 {
 	if (!in_heap(bp)){
-		printf("(%p) Error: not in heap!!\n", bp);
+		printf("(%d) %p: not in heap\n", lineno, bp);
 	}
 	if (!aligned(bp)){
-		printf("(%p) Error: not alinged!!\n", bp);
+		printf("(%d) %p: not aligned\n", lineno, bp);
+	}
+	if ((int)GET_PREV_ALLOC(HDRP(bp)) != prev_alloc){
+		printf("(%d) %p: prev-alloc bit is %u, previous block is %s\n",
+			lineno, bp, GET_PREV_ALLOC(HDRP(bp)),
+			prev_alloc ? "allocated" : "free");
+	}
+	if (!GET_ALLOC(HDRP(bp))){
+		if (GET(HDRP(bp)) != GET(FTRP(bp))){
+			printf("(%d) %p: header and footer differ\n", lineno, bp);
+		}
+		if (!prev_alloc || !GET_ALLOC(HDRP(NEXT_BLKP(bp)))){
+			printf("(%d) %p: not coalesced\n", lineno, bp);
+		}
 	}
-	return;
 }
 
-static void print_block(void *bp)
+/* check_free
+ * Check that every block in the seg lists is free, in the heap and in
+ * the right list, that the links agree both ways, that seg_map matches
+ * the entries, and that the lists hold every free block of the heap.
+ */
+static void check_free(int lineno)
 {
-	int hsize, halloc, fsize, falloc, prev_alloc;
-
-	/* Basic header and footer information */
-	hsize = GET_SIZE(HDRP(bp));
-	halloc = GET_ALLOC(HDRP(bp));
-	fsize = GET_SIZE(FTRP(bp));
-	falloc = GET_ALLOC(FTRP(bp));
-	prev_alloc = GET_PREV_ALLOC(bp);
-
-	if (hsize == 0) 
-	{
-		printf("%p: EOL\n", bp);
-		return;
+	unsigned int count_seg = 0;
+	unsigned int count_all = 0;
+	void *bp;
+
+	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)){
+		if (!GET_ALLOC(HDRP(bp))){
+			count_all++;
+		}
+	}
+
+	for (int i = 0; i < SEG_NUM; i++){
+		if ((SEG_ENTRY(seg_list, i) != NULL) != ((seg_map >> i) & 1)){
+			printf("(%d) Seg map bit %d doesn't match seg entry\n",
+				lineno, i);
+		}
+		for (bp = SEG_ENTRY(seg_list, i); bp != NULL; bp = NEXT_FRPT(bp)){
+			count_seg++;
+			if (!in_heap(bp) || GET_ALLOC(HDRP(bp))){
+				printf("(%d) %p: bad block in seg %d\n", lineno, bp, i);
+				return;
+			}
+			if ((int)get_list_number(GET_SIZE(HDRP(bp))) != i){
+				printf("(%d) %p: in wrong seg %d\n", lineno, bp, i);
+			}
+			if (NEXT_FRPT(bp) != NULL && PREV_FRPT(NEXT_FRPT(bp)) != bp){
+				printf("(%d) %p: next block's prev doesn't match\n",
+					lineno, bp);
+			}
+		}
+	}
+
+	if (count_all != count_seg){
+		printf("(%d) Free list amount doesn't match: %u in heap, "
+			"%u in seg lists\n", lineno, count_all, count_seg);
 	}
-	
-	/* Prints out header and footer info if it's an allocated block.
-	 * Prints out header and footer info and next and prev info
-	 * if it's a free block.
-	*/
-	if (halloc)
-		printf("%p: header:[%d:%c] footer:[%d:%c]\n", bp,
-			hsize, (halloc ? 'a' : 'f'),
-			prev_alloc, (falloc ? 'a' : 'f'));
-	else
-		printf("%p:header:[%d:%c] prev:%p next:%p footer:[%d:%c]\n",
-			bp, hsize, (halloc ? 'a' : 'f'), PREV_FRPT(bp),
-			NEXT_FRPT(bp), prev_alloc, (falloc ? 'a' : 'f'));
 }
 
-static unsigned int get_list_number(size_t size)
+/*
+ * Print a block: address, size, allocated and prev-alloc bits, and
+ * the links and footer of a free block.
+ */
+static void print_block(void *bp)
 {
-	if (size <= 8)
-		return 0;
-	else if (size <= 16)
-		return 1;
-	else if (size <= 24)
-		return 2;
-	else if (size <= 32)
-		return 3;
-	else if (size <= 56)
-		return 4;
-	else if (size <= 72)
-		return 5;
-	else if (size <= 128)
-		return 6;
-	else if (size <= 256)
-		return 7;
-	else if (size <= 512)
-		return 8;
-	else if (size <= 1024)
-		return 9;
-	else if (size <= 2048)
-		return 10;
-	else if (size <= 4096)
-		return 11;
-	else if (size <= 8192)
-		return 12;
-	else
-		return 13;
+	unsigned int size = GET_SIZE(HDRP(bp));
+
+	if (GET_ALLOC(HDRP(bp))){
+		printf("%p: header:[%u:a:%u]\n", bp, size,
+			GET_PREV_ALLOC(HDRP(bp)));
+	}
+	else {
+		printf("%p: header:[%u:f:%u] prev:%p next:%p footer:[%u:%c]\n",
+			bp, size, GET_PREV_ALLOC(HDRP(bp)), PREV_FRPT(bp),
+			NEXT_FRPT(bp), GET_SIZE(FTRP(bp)),
+			GET_ALLOC(FTRP(bp)) ? 'a' : 'f');
+	}
+}
+
+/*
+ * Return whether the pointer is in the heap.
+ * May be useful for debugging.
+ */
+static int in_heap(const void *p) {
+	return p <= mem_heap_hi() && p >= mem_heap_lo();
+}
+
+/*
+ * Return whether the pointer is aligned.
+ * May be useful for debugging.
+ */
+static int aligned(const void *p) {
+	return (size_t)ALIGN(p) == (size_t)p;
 }
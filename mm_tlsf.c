@@ -0,0 +1,650 @@
+/*
+ * mm_tlsf.c
+ * Two-level segregated fit (TLSF) allocator.
+ * Blocks use the same boundary tags as mm.c: a 4-byte header and footer
+ * holding the size and allocated bit, a prologue and an epilogue around
+ * the heap, and prev/next free pointers in the payload of free blocks.
+ * Free blocks are kept on FL_COUNT * SL_COUNT LIFO lists. The first
+ * level splits sizes by powers of two, the second level splits each
+ * power-of-two range into SL_COUNT equal slices. Sizes below SMALL_BLOCK
+ * all share first level 0, one slice per ALIGNMENT bytes.
+ * One bit per first level and one bit per list say which lists are
+ * non-empty, so malloc finds a list with a large enough block with two
+ * count-trailing-zeros and never walks a list: the request is rounded
+ * up to the next slice boundary, so every block of the list found fits.
+ * Insert and remove are O(1) doubly-linked list operations, free
+ * coalesces immediately with both neighbours, so malloc and free both
+ * run in bounded time apart from extending the heap.
+ * The list heads and bitmaps are static, like mm.c's seg_map, so they
+ * take no room in the heap.
+ * Each block needs to have at least 24 bytes. Data structures are:
+ * Allocated                  Free
+ *   [Header: size, 1]         [Header: size, 0]
+ *   [....Payload....]         [Ptr to PrevFRBK]
+ *   [Footer: size, 1]         [Ptr to NextFRBK]
+ *                             [ ............. ]
+ *                             [Footer: size, 0]
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+/* If you want debugging output, use the following macro.  When you hand
+ * in, remove the #define DEBUG line. */
+#ifdef DEBUG
+# define dbg_printf(...) printf(__VA_ARGS__)
+#else
+# define dbg_printf(...)
+#endif
+
+
+/* do not change the following! */
+#ifdef DRIVER
+/* create aliases for driver tests */
+#define malloc mm_malloc
+#define free mm_free
+#define realloc mm_realloc
+#define calloc mm_calloc
+#endif /* def DRIVER */
+
+/* single word (4) or double word (8) alignment */
+#define ALIGNMENT 8
+
+/* rounds up to the nearest multiple of ALIGNMENT */
+#define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~0x7)
+
+/* Basic constants and macros */
+#define WSIZE       4       /* Word and header/footer size (bytes) */
+#define DSIZE       8       /* Double word size (bytes) */
+#define CHUNKSIZE   168		/* Extend heap by this amount (bytes) */
+#define MINIMUM		24		/* Minimum block size head + foot = 8,
+                               prev + next = 16. Total 24(bytes).*/
+
+/* TLSF parameters */
+#define SL_LOG2		4		/* log2 of the slices per first level */
+#define SL_COUNT	(1 << SL_LOG2)
+#define FL_SHIFT	(SL_LOG2 + 3)	/* log2 of SMALL_BLOCK, 3 = log2(ALIGNMENT) */
+#define SMALL_BLOCK	(1 << FL_SHIFT)	/* Sizes below share first level 0 */
+#define FL_COUNT	(32 - FL_SHIFT + 1)	/* Sizes fit the 32-bit header */
+#define MAX_REQUEST	(1U << 31)		/* Rounding up must stay below 2^32 */
+
+
+/*** Macros ***/
+#define MAX(x, y) ((x) > (y)? (x) : (y))
+
+/* Pack a size and allocated bit into a word */
+#define PACK(size, alloc)  ((size) | (alloc))
+
+/* Read and write a word at address p */
+#define GET(p)       (*(unsigned int *)(p))
+#define PUT(p, val)  (*(unsigned int *)(p) = (val))
+
+/* Read the size and allocated fields from address p */
+#define GET_SIZE(p)  (GET(p) & ~0x7)
+#define GET_ALLOC(p) (GET(p) & 0x1)
+
+/* Given block ptr bp,compute address of its header and footer */
+#define HDRP(bp) ((void *)(bp) - WSIZE)
+#define FTRP(bp) ((void *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
+
+/* Given block ptr bp,compute address of next and previous blocks */
+#define NEXT_BLKP(bp) ((void *)(bp) + GET_SIZE(HDRP(bp)))
+#define PREV_BLKP(bp) ((void *)(bp) - GET_SIZE(HDRP(bp) - WSIZE))
+
+/* Given block ptr bp, compute address of next and previous free blocks */
+#define NEXT_FRPT(bp) (*(void **)(bp + DSIZE))
+#define PREV_FRPT(bp) (*(void **)(bp))
+
+/* Floor of log2(x), for x > 0 */
+#define FLS(x)		(31 - __builtin_clz(x))
+/*** Macros End ***/
+
+/* List heads and bitmaps, kept in static storage.
+ * Bit fl of fl_map is set iff sl_map[fl] is non-zero,
+ * bit sl of sl_map[fl] is set iff list[fl][sl] is non-empty.
+ */
+struct tlsf_control {
+	unsigned int fl_map;
+	unsigned int sl_map[FL_COUNT];
+	void *list[FL_COUNT][SL_COUNT];
+};
+
+/*** Declaration ***/
+static void *coalesce(void *ptr);
+static void *extend_heap(size_t words);
+static void *find_fit(size_t size);
+static void place(void *bp, size_t size);
+static void delete_block(void *bp);
+static void *add_block(void *bp);
+static void mapping_insert(size_t size, unsigned int *fl, unsigned int *sl);
+static void mapping_search(size_t size, unsigned int *fl, unsigned int *sl);
+static void check_block(int lineno, void *bp);
+static void check_free(int lineno);
+static int in_heap(const void *p);
+static int aligned(const void *p);
+/*** Declaration End ***/
+
+/* Global Variables: control, heap_listp */
+static struct tlsf_control control;
+static char *heap_listp = 0;
+
+
+/* Malloc Routine: init, malloc, free, realloc, calloc */
+/*
+ * mm_init
+ * Initialize: return -1 on error, 0 on success.
+ * Empty every list, then set prologue header, footer and Epilogue head
+ * for the heap.
+ */
+int mm_init(void) {
+	memset(&control, 0, sizeof(control));
+
+	/* Create the initial empty heap */
+	if ((long)(heap_listp = mem_sbrk(4 * WSIZE)) == -1){
+		return -1;
+	}
+	PUT(heap_listp, 0);
+	PUT(heap_listp + (1*WSIZE), PACK(DSIZE, 1)); /* Prologue header */
+	PUT(heap_listp + (DSIZE), PACK(DSIZE, 1)); /* Prologue footer */
+	PUT(heap_listp + (3*WSIZE), PACK(0, 1)); /*Epilogue head */
+
+	heap_listp += (DSIZE);
+
+	/* Extend the empty heap with a free block of CHUNKSIZE bytes */
+	if (extend_heap(CHUNKSIZE/WSIZE) == NULL){
+		return -1;
+	}
+	return 0;
+}
+
+
+/*
+ * malloc
+ * First align block size. Each block must has at least 24 bytes.
+ * Take a block from the first non-empty list that only holds blocks
+ * large enough, extending the heap if there is none.
+ */
+void *malloc (size_t size) {
+	size_t asize; /* Adjusted block size */
+	size_t extendsize; /* Amount to extend heap if not fit */
+	char *bp;
+
+	if (heap_listp == 0){
+		mm_init();
+	}
+
+	if (size <= 0 || size >= MAX_REQUEST){
+		return NULL;
+	}
+
+	asize = MAX(ALIGN(size + DSIZE), MINIMUM);
+
+	/* find if there is a free block to allocate */
+	if ((bp = find_fit(asize))) {
+		place(bp, asize);
+		return bp;
+	}
+
+	/* If free block does not exist, extend the heap */
+	extendsize = MAX(asize, CHUNKSIZE);
+	if ((bp = extend_heap(extendsize/WSIZE)) == NULL){
+		return NULL;
+	}
+	place(bp, asize);
+	return bp;
+}
+
+/*
+ * free
+ * Set current header and footer allocated bit to 0;
+ * Coalesce and add this block back to its free list.
+ */
+void free (void *ptr) {
+	if (ptr == 0){
+		return;
+	}
+
+	size_t size = GET_SIZE(HDRP(ptr));
+
+	if (heap_listp == 0){
+		mm_init();
+	}
+
+	PUT(HDRP(ptr), PACK(size, 0));
+	PUT(FTRP(ptr), PACK(size, 0));
+	add_block(ptr);
+}
+
+/*
+ * realloc
+ * Shrink in place, otherwise malloc, copy and free.
+ */
+void *realloc(void *ptr, size_t size) {
+	size_t oldsize;
+	void *newptr;
+	size_t asize = MAX(ALIGN(size) + DSIZE, MINIMUM);
+	/* If size <= 0 then this is just free, and we return NULL. */
+	if(size <= 0) {
+		free(ptr);
+		return 0;
+	}
+
+	/* If oldptr is NULL, then this is just malloc. */
+	if(ptr == NULL) {
+		return malloc(size);
+	}
+
+	/* Get the size of the original block */
+	oldsize = GET_SIZE(HDRP(ptr));
+
+	/* If the size doesn't need to be changed, return orig pointer */
+	if (asize == oldsize)
+		return ptr;
+
+	/* If the size needs to be decreased, shrink the block and
+	 * return the same pointer */
+	if(asize <= oldsize)
+	{
+		/* If a new block couldn't fit in the remaining space,
+		 * return the pointer */
+		if(oldsize - asize < MINIMUM)
+			return ptr;
+		PUT(HDRP(ptr), PACK(asize, 1));
+		PUT(FTRP(ptr), PACK(asize, 1));
+		PUT(HDRP(NEXT_BLKP(ptr)), PACK(oldsize-asize, 0));
+		PUT(FTRP(NEXT_BLKP(ptr)), PACK(oldsize-asize, 0));
+		add_block(NEXT_BLKP(ptr));
+		return ptr;
+	}
+
+	newptr = malloc(size);
+
+	/* If realloc() fails the original block is left untouched  */
+	if(!newptr) {
+		return 0;
+	}
+
+	/* Copy the old payload, the block less its header and footer. */
+	oldsize -= DSIZE;
+	if(size < oldsize) oldsize = size;
+	memcpy(newptr, ptr, oldsize);
+
+	/* Free the old block. */
+	free(ptr);
+
+	return newptr;
+
+}
+
+/*
+ * calloc
+ * This function is not tested by mdriver, but it is
+ * needed to run the traces.
+ */
+void *calloc (size_t nmemb, size_t size) {
+	size_t bytes = nmemb * size;
+	void *newptr;
+
+	newptr = malloc(bytes);
+	if (newptr != NULL){
+		memset(newptr, 0, bytes);
+	}
+
+	return newptr;
+}
+
+
+
+
+/* Helper functions: Coalesce, extend, find fit, place,
+ *			   add block, delete block, size mapping.
+ */
+
+/* coalesce
+ * para: current pointer ptr to a free block.
+ * Check if the adjacent blocks are free.
+ * If any of the previous or next block is free,
+ * coalesce those blocks.
+ */
+static void *coalesce(void *ptr) {
+	size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(ptr)));
+	size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
+	size_t size = GET_SIZE(HDRP(ptr));
+
+	if (prev_alloc && next_alloc) {
+		/* pre block and next block both been allocated */
+		return ptr;
+	}
+
+	if (prev_alloc && !next_alloc){
+		/* next block not allocated */
+		size += GET_SIZE(HDRP(NEXT_BLKP(ptr)));
+		delete_block(NEXT_BLKP(ptr));
+		PUT(HDRP(ptr), PACK(size, 0));
+		PUT(FTRP(ptr), PACK(size, 0));
+	}
+
+	else if (!prev_alloc && next_alloc){
+		/* previous block not allocated */
+		ptr = PREV_BLKP(ptr);
+		size += GET_SIZE(HDRP(ptr));
+		delete_block(ptr);
+		PUT(HDRP(ptr), PACK(size, 0));
+		PUT(FTRP(ptr), PACK(size, 0));
+	}
+
+	else {
+		/* Both blocks not allocated */
+		size = size + GET_SIZE(HDRP(PREV_BLKP(ptr)))
+		+ GET_SIZE(FTRP(NEXT_BLKP(ptr)));
+		delete_block(PREV_BLKP(ptr));
+		delete_block(NEXT_BLKP(ptr));
+		PUT(HDRP(PREV_BLKP(ptr)), PACK(size, 0));
+		PUT(FTRP(NEXT_BLKP(ptr)), PACK(size, 0));
+		ptr = PREV_BLKP(ptr);
+	}
+
+	return ptr;
+}
+
+/* extend_heap
+ * When find fit can't find a free block to allocate, extend the heap.
+ * Initialize header, footer and epilougue header.
+ * Add new free block to its list, coalescing with a free last block.
+ */
+static void *extend_heap(size_t words)
+{
+	char *bp;
+	size_t size;
+	/* Allocate an even number of words to maintain alignment */
+	size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
+	if (size < MINIMUM){
+		size = MINIMUM;
+	}
+	if ((long)(bp = mem_sbrk(size)) == -1){
+		return NULL;
+	}
+
+	/* Initialize free block header/footer and the epilogue header */
+	PUT(HDRP(bp), PACK(size, 0)); /* Free block header */
+	PUT(FTRP(bp), PACK(size, 0)); /* Free block footer */
+	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
+
+	return add_block(bp);
+}
+
+/* mapping_insert
+ * para: block size, out first and second level.
+ * Compute the list a free block of this size belongs to.
+ */
+static void mapping_insert(size_t size, unsigned int *fl, unsigned int *sl)
+{
+	unsigned int f;
+
+	if (size < SMALL_BLOCK){
+		*fl = 0;
+		*sl = size / ALIGNMENT;
+	}
+	else {
+		f = FLS(size);
+		*sl = (size >> (f - SL_LOG2)) ^ SL_COUNT;
+		*fl = f - FL_SHIFT + 1;
+	}
+}
+
+/* mapping_search
+ * para: request size, out first and second level.
+ * Round size up to the next slice boundary, so that every block on
+ * the resulting list, and on any list above it, is large enough.
+ */
+static void mapping_search(size_t size, unsigned int *fl, unsigned int *sl)
+{
+	if (size >= SMALL_BLOCK){
+		size += (1U << (FLS(size) - SL_LOG2)) - 1;
+	}
+	mapping_insert(size, fl, sl);
+}
+
+/* find fit
+ * para: required size.
+ * Good fit in constant time: the lowest non-empty list of the
+ * rounded-up slice, searching this first level then the ones above.
+ * Return the head of that list, or NULL if there is none.
+ */
+static void *find_fit(size_t size)
+{
+	unsigned int fl, sl, map;
+
+	mapping_search(size, &fl, &sl);
+	if (fl >= FL_COUNT){
+		return NULL;
+	}
+
+	map = control.sl_map[fl] & (~0U << sl);
+	if (map == 0){
+		/* No slice left at this level, take the next non-empty level */
+		map = fl + 1 < FL_COUNT ? control.fl_map & (~0U << (fl + 1)) : 0;
+		if (map == 0){
+			return NULL;
+		}
+		fl = __builtin_ctz(map);
+		map = control.sl_map[fl];
+	}
+	sl = __builtin_ctz(map);
+
+	return control.list[fl][sl];
+}
+
+/* place
+ * para: current pointer bp, block size.
+ * Place block at begining of a free block. Split if
+ * remaining block is larger than minimum size. Otherwise
+ * allocte entire free block.
+ */
+static void place(void *bp, size_t asize)
+{
+	size_t csize = GET_SIZE(HDRP(bp));
+
+	delete_block(bp);
+	if ((csize - asize) >= MINIMUM){
+		/* Split, the remainder cannot have a free neighbour */
+		PUT(HDRP(bp), PACK(asize, 1));
+		PUT(FTRP(bp), PACK(asize, 1));
+		bp = NEXT_BLKP(bp);
+		PUT(HDRP(bp), PACK(csize - asize, 0));
+		PUT(FTRP(bp), PACK(csize - asize, 0));
+		add_block(bp);
+	}
+	else {
+		/* Allocate entire block */
+		PUT(HDRP(bp), PACK(csize, 1));
+		PUT(FTRP(bp), PACK(csize, 1));
+	}
+}
+
+/* add_block
+ * para: pointer to current block
+ * Coalesce first, then push the block on the head of its list
+ * and mark the list and its first level non-empty.
+ */
+static void *add_block(void *bp)
+{
+	unsigned int fl, sl;
+	void *head;
+
+	bp = coalesce(bp);
+	mapping_insert(GET_SIZE(HDRP(bp)), &fl, &sl);
+
+	head = control.list[fl][sl];
+	PREV_FRPT(bp) = NULL;
+	NEXT_FRPT(bp) = head;
+	if (head != NULL){
+		PREV_FRPT(head) = bp;
+	}
+	control.list[fl][sl] = bp;
+	control.fl_map |= 1U << fl;
+	control.sl_map[fl] |= 1U << sl;
+
+	return bp;
+}
+
+/* delete_block
+ * para: pointer to current block
+ * Unlink the block from its list. If the list becomes empty clear
+ * its bit, and the first level bit if that was the last list.
+ */
+static void delete_block(void *bp)
+{
+	unsigned int fl, sl;
+	void *prev = PREV_FRPT(bp);
+	void *next = NEXT_FRPT(bp);
+
+	mapping_insert(GET_SIZE(HDRP(bp)), &fl, &sl);
+
+	if (next != NULL){
+		PREV_FRPT(next) = prev;
+	}
+	if (prev != NULL){
+		NEXT_FRPT(prev) = next;
+	}
+	else {
+		control.list[fl][sl] = next;
+		if (next == NULL){
+			control.sl_map[fl] &= ~(1U << sl);
+			if (control.sl_map[fl] == 0){
+				control.fl_map &= ~(1U << fl);
+			}
+		}
+	}
+}
+
+
+/* Check functions */
+/*
+ * mm_checkheap
+ * Call checkheap with non zero numbers, e.g. __LINE__ of the caller,
+ * which is printed with every error.
+ * Check Prologue, Epilogue of the heap, whether each block is in heap,
+ * aligned, has a matching header and footer, and is coalesced. Then
+ * check the free lists and the bitmaps against each other.
+ */
+void mm_checkheap(int lineno) {
+	void *bp;
+
+	if (!lineno){
+		return;
+	}
+
+	if ((GET_SIZE(HDRP(heap_listp))!=DSIZE)||
+		!GET_ALLOC(HDRP(heap_listp))){
+		printf("(%d) Prologue header error\n", lineno);
+	}
+	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)){
+		check_block(lineno, bp);
+	}
+	/* when bp is point to the end of the list, check epilogue */
+	if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp)))){
+		printf("(%d) Epilogue header error\n", lineno);
+	}
+
+	check_free(lineno);
+}
+
+/*
+ * Basic block checks: Check whether the block is in heap,
+ * correctly aligned, its header matches its footer, and that
+ * no two free blocks are adjacent.
+ * para: lineno of the caller, bp, pointer of the current block.
+ */
+static void check_block(int lineno, void *bp)
+{
+	if (!in_heap(bp)){
+		printf("(%d) %p: not in heap\n", lineno, bp);
+	}
+	if (!aligned(bp)){
+		printf("(%d) %p: not aligned\n", lineno, bp);
+	}
+	if (GET(HDRP(bp)) != GET(FTRP(bp))){
+		printf("(%d) %p: header and footer differ\n", lineno, bp);
+	}
+	if (!GET_ALLOC(HDRP(bp)) && !GET_ALLOC(HDRP(NEXT_BLKP(bp)))){
+		printf("(%d) %p: not coalesced with next block\n", lineno, bp);
+	}
+}
+
+/* check_free
+ * Check every free list: its blocks are free, belong to the list by
+ * size and are doubly linked correctly. Check the bitmaps say exactly
+ * which lists are non-empty, and that the lists hold every free block
+ * of the heap.
+ */
+static void check_free(int lineno)
+{
+	unsigned int count_list = 0;
+	unsigned int count_all = 0;
+	unsigned int fl, sl, f, s;
+	void *bp;
+
+	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+		if(!GET_ALLOC(HDRP(bp))) {
+			count_all++;
+		}
+	}
+
+	for (fl = 0; fl < FL_COUNT; fl++){
+		if (((control.fl_map >> fl) & 1) != (control.sl_map[fl] != 0)){
+			printf("(%d) First level bit %u is wrong\n", lineno, fl);
+		}
+		for (sl = 0; sl < SL_COUNT; sl++){
+			bp = control.list[fl][sl];
+			if (((control.sl_map[fl] >> sl) & 1) != (bp != NULL)){
+				printf("(%d) Second level bit %u/%u is wrong\n",
+					lineno, fl, sl);
+			}
+			for (; bp != NULL; bp = NEXT_FRPT(bp)){
+				count_list++;
+				if (!in_heap(bp) || GET_ALLOC(HDRP(bp))){
+					printf("(%d) %p: bad block in list %u/%u\n",
+						lineno, bp, fl, sl);
+					return;
+				}
+				mapping_insert(GET_SIZE(HDRP(bp)), &f, &s);
+				if (f != fl || s != sl){
+					printf("(%d) %p: in list %u/%u, belongs in %u/%u\n",
+						lineno, bp, fl, sl, f, s);
+				}
+				if (NEXT_FRPT(bp) != NULL && PREV_FRPT(NEXT_FRPT(bp)) != bp){
+					printf("(%d) %p: next block's prev doesn't match\n",
+						lineno, bp);
+				}
+			}
+		}
+	}
+
+	if (count_all != count_list){
+		printf("(%d) Free list amount doesn't match: %u in heap, "
+			"%u in lists\n", lineno, count_all, count_list);
+	}
+}
+
+/*
+ * Return whether the pointer is in the heap.
+ * May be useful for debugging.
+ */
+static int in_heap(const void *p) {
+	return p <= mem_heap_hi() && p >= mem_heap_lo();
+}
+
+/*
+ * Return whether the pointer is aligned.
+ * May be useful for debugging.
+ */
+static int aligned(const void *p) {
+	return (size_t)ALIGN(p) == (size_t)p;
+}
@@ -0,0 +1,106 @@
+/*
+ * rep2bin - Convert text traces to the binary format of trace.h, which
+ *     the driver maps instead of parsing. Each <name>.rep on the command
+ *     line is written to <name>.bin beside it; the driver then uses the
+ *     .bin in place of the .rep for as long as it is the newer of the two.
+ *
+ *     unix> ./rep2bin traces/needle.rep traces/exhaust.rep
+ *
+ * Requests are read by the driver's own parser, parse_rep in trace.c:
+ * a missing size reads as 0, and the header's request count is only a
+ * hint, the binary header recording the count actually found.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024    /* max string size */
+
+static int convert(char *path);
+
+int main(int argc, char **argv)
+{
+    int i, errors = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: rep2bin <file.rep>...\n");
+        exit(1);
+    }
+    for (i = 1; i < argc; i++)
+        errors += convert(argv[i]);
+    return errors ? 1 : 0;
+}
+
+/*
+ * convert - Write the binary form of the trace in path. Return 0 on
+ *     success, or print why not and return 1.
+ */
+static int convert(char *path)
+{
+    FILE *in, *out;
+    tracebin_t hdr;
+    traceop_t probe = TRACEBIN_PROBE;
+    traceop_t *ops;
+    char binpath[MAXLINE], tmppath[MAXLINE + 4];
+    char err[2 * MAXLINE];
+    int num_ops;
+    size_t len = strlen(path);
+
+    if (len < 4 || len >= MAXLINE || strcmp(path + len - 4, ".rep") != 0) {
+        fprintf(stderr, "%s: not a .rep file\n", path);
+        return 1;
+    }
+    snprintf(binpath, MAXLINE, "%.*s.bin", (int)(len - 4), path);
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", binpath);
+
+    if ((in = fopen(path, "r")) == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    num_ops = parse_rep(in, path, &hdr, &ops, err, sizeof(err));
+    fclose(in);
+    if (num_ops < 0) {
+        fprintf(stderr, "%s\n", err);
+        return 1;
+    }
+
+    hdr.magic = TRACEBIN_MAGIC;
+    hdr.version = TRACEBIN_VERSION;
+    hdr.num_ops = num_ops;
+    hdr.probe = probe;
+
+    /* Write to a scratch file and rename it, so that a driver running
+       meanwhile never maps half a trace */
+    if ((out = fopen(tmppath, "w")) == NULL) {
+        fprintf(stderr, "%s: %s\n", tmppath, strerror(errno));
+        free(ops);
+        return 1;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+        (num_ops > 0 &&
+         fwrite(ops, sizeof(traceop_t), num_ops, out) != (size_t)num_ops)) {
+        fprintf(stderr, "%s: %s\n", tmppath, strerror(errno));
+        fclose(out);
+        goto fail;
+    }
+    if (fclose(out) != 0) {
+        fprintf(stderr, "%s: %s\n", tmppath, strerror(errno));
+        goto fail;
+    }
+    if (rename(tmppath, binpath) != 0) {
+        fprintf(stderr, "%s: %s\n", binpath, strerror(errno));
+        goto fail;
+    }
+    free(ops);
+    return 0;
+
+ fail:
+    unlink(tmppath);
+    free(ops);
+    return 1;
+}
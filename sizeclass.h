@@ -0,0 +1,91 @@
+#ifndef __SIZECLASS_H_
+#define __SIZECLASS_H_
+
+/*
+ * sizeclass.h - constant-time mapping from a block size to the index of
+ *     its segregated free list, shared by the allocator variants.
+ *
+ * A variant describes its classes by an ascending list of inclusive
+ * upper bounds, in whatever unit it measures sizes in (bytes, words or
+ * double words). Sizes above the last bound fall into one final class.
+ * The bounds are fixed at build time; sizeclass_init turns them into
+ * two small tables so that size_class costs one table load for small
+ * sizes, and a count-leading-zeros, a table load and a compare for the
+ * rest, instead of a chain of comparisons.
+ *
+ * Above SC_SMALL_MAX, consecutive bounds must at least double, so that
+ * every power-of-two range [2^k, 2^(k+1)) holds at most one bound.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+
+#define SC_SMALL_MAX    64  /* Sizes up to this are looked up directly */
+#define SC_MAX_CLASSES  64  /* Most classes a variant may define */
+#define SC_LOG_MAX      (8 * sizeof(size_t))
+
+struct size_classes {
+    unsigned char small[SC_SMALL_MAX + 1]; /* class of each small size */
+    unsigned char log_class[SC_LOG_MAX];   /* class of 2^k, for each k */
+    size_t bound[SC_MAX_CLASSES];          /* inclusive bound of a class */
+    unsigned int num;                      /* number of classes */
+};
+
+/* Floor of log2(size), for size > 0 */
+static inline unsigned int sc_log2(size_t size)
+{
+    return SC_LOG_MAX - 1 - __builtin_clzl(size);
+}
+
+/*
+ * sizeclass_init - Build the lookup tables for the n ascending bounds
+ *     in bounds[]. The classes are 0..n, class n holding every size
+ *     above bounds[n-1].
+ */
+static inline void sizeclass_init(struct size_classes *sc,
+                                  const size_t *bounds, unsigned int n)
+{
+    unsigned int c, k;
+    size_t s;
+
+    assert(n < SC_MAX_CLASSES);
+    for (c = 0; c < n; c++) {
+        assert(c == 0 || bounds[c] > bounds[c - 1]);
+        sc->bound[c] = bounds[c];
+    }
+    sc->bound[n] = (size_t)-1;
+    sc->num = n + 1;
+
+    for (s = 0, c = 0; s <= SC_SMALL_MAX; s++) {
+        while (s > sc->bound[c])
+            c++;
+        sc->small[s] = c;
+    }
+
+    for (k = 0; k < SC_LOG_MAX; k++) {
+        s = (size_t)1 << k;
+        for (c = 0; s > sc->bound[c]; c++)
+            ;
+        sc->log_class[k] = c;
+
+        /* The top of the range may be at most one class further on */
+        assert((s << 1) - 1 <= SC_SMALL_MAX || c == n ||
+               (s << 1) - 1 <= sc->bound[c + 1]);
+    }
+}
+
+/*
+ * size_class - Return the class of a block of the given size
+ */
+static inline unsigned int size_class(const struct size_classes *sc,
+                                      size_t size)
+{
+    unsigned int c;
+
+    if (size <= SC_SMALL_MAX)
+        return sc->small[size];
+    c = sc->log_class[sc_log2(size)];
+    return c + (size > sc->bound[c]);
+}
+
+#endif /* __SIZECLASS_H_ */
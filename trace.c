@@ -0,0 +1,103 @@
+/*
+ * trace.c - The .rep trace parser shared by mdriver.c and rep2bin.c, so
+ *     that a trace reads the same whether it is replayed as text or
+ *     converted to a binary trace first.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+#define MAXLINE     1024 /* max string size */
+#define HDRLINES    4    /* number of header lines in a trace file */
+
+/*
+ * parse_rep - Read the .rep trace open as f, named path in messages.
+ *     Fill in the weight, num_ids, num_ops and flag of hdr from its
+ *     header, and point *ops at a malloc'd array of its requests.
+ *     Return the number of requests found, or -1 with the reason in err.
+ *
+ *     A missing size is read as a zero-byte request, and num_ops is only
+ *     a sizing hint: some captured traces disagree with their own header.
+ */
+int parse_rep(FILE *f, const char *path, tracebin_t *hdr, traceop_t **ops,
+              char *err, size_t errlen)
+{
+    char type[2];
+    char line[MAXLINE];
+    int index, size;
+    int op_index, max_ops, linenum;
+    traceop_t *new_ops;
+
+    *ops = NULL;
+    if (fscanf(f, "%d", &hdr->weight) != 1 ||
+        fscanf(f, "%d", &hdr->num_ids) != 1 ||
+        fscanf(f, "%d", &hdr->num_ops) != 1 ||
+        fscanf(f, "%d", &hdr->flag) != 1 ||
+        hdr->num_ids < 0 || hdr->num_ops < 0) {
+        snprintf(err, errlen, "Malformed header in %s", path);
+        return -1;
+    }
+
+    /* We'll store each request line in the trace in this array */
+    max_ops = hdr->num_ops + 1;
+    if ((*ops = (traceop_t *)malloc(max_ops * sizeof(traceop_t))) == NULL)
+        goto nomem;
+
+    op_index = 0;
+    linenum = HDRLINES;
+    if (fgets(line, MAXLINE, f) == NULL) /* rest of header line */
+        line[0] = '\0';
+    while (fgets(line, MAXLINE, f) != NULL) {
+        linenum++;
+        index = -1;
+        size = 0;
+        if (sscanf(line, "%1s %d %d", type, &index, &size) < 2)
+            continue; /* blank line */
+        if (op_index == max_ops) {
+            max_ops *= 2;
+            if ((new_ops = (traceop_t *)
+                 realloc(*ops, max_ops * sizeof(traceop_t))) == NULL)
+                goto nomem;
+            *ops = new_ops;
+        }
+        switch(type[0]) {
+        case 'a':
+            (*ops)[op_index].type = ALLOC;
+            break;
+        case 'r':
+            (*ops)[op_index].type = REALLOC;
+            break;
+        case 'f':
+            (*ops)[op_index].type = FREE;
+            size = 0;
+            break;
+        default:
+            snprintf(err, errlen, "Bogus request in %s, line %d",
+                     path, linenum);
+            goto fail;
+        }
+        if (index < -1 || index >= hdr->num_ids ||
+            (index == -1 && type[0] != 'f')) {
+            snprintf(err, errlen, "Block id %d out of range in %s, line %d",
+                     index, path, linenum);
+            goto fail;
+        }
+        if (size < 0 || size >= (1 << 30)) {
+            snprintf(err, errlen, "Request size %d out of range in %s, line %d",
+                     size, path, linenum);
+            goto fail;
+        }
+        (*ops)[op_index].index = index;
+        (*ops)[op_index].size = size;
+        op_index++;
+    }
+    return op_index;
+
+ nomem:
+    snprintf(err, errlen, "Out of memory reading %s", path);
+ fail:
+    free(*ops);
+    *ops = NULL;
+    return -1;
+}
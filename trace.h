@@ -0,0 +1,52 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * trace.h - In-memory form of a trace request, the binary trace format
+ *     built on it, and the .rep parser (trace.c), shared by mdriver.c
+ *     and rep2bin.c.
+ *
+ * A binary trace (.bin) is a header followed by the num_ops requests as
+ * an array of traceop_t, exactly as the driver keeps them in memory, so
+ * the driver can map the file and replay it in place. The header carries
+ * the four fields of a .rep header, and a known request encoded by the
+ * converter: a driver built with a different traceop_t layout (another
+ * compiler or byte order) sees it differ and rejects the file.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Characterizes a single trace operation (allocator request) */
+typedef enum {ALLOC, FREE, REALLOC} traceop_type;
+
+/*
+ * Trace requests are preloaded into a flat array before any timing
+ * starts, so a request is kept as small as possible.
+ */
+typedef struct {
+    uint32_t type:2;     /* type of request */
+    uint32_t size:30;    /* byte size of alloc/realloc request */
+    int index;           /* id of the block, or -1 for free(NULL) */
+} traceop_t;
+
+#define TRACEBIN_MAGIC    0x6e696274  /* "tbin" on a little-endian box */
+#define TRACEBIN_VERSION  1
+#define TRACEBIN_PROBE    {REALLOC, 0x2345678, -2}
+
+/* Header of a binary trace; the requests follow it directly */
+typedef struct {
+    uint32_t magic;      /* TRACEBIN_MAGIC */
+    uint32_t version;    /* TRACEBIN_VERSION */
+    int32_t weight;      /* the .rep header, in order */
+    int32_t num_ids;
+    int32_t num_ops;     /* requests in the file, exactly */
+    int32_t flag;
+    traceop_t probe;     /* TRACEBIN_PROBE, as the writer laid it out */
+} tracebin_t;
+
+/* Read a .rep trace into hdr and a malloc'd array of requests (trace.c) */
+int parse_rep(FILE *f, const char *path, tracebin_t *hdr, traceop_t **ops,
+              char *err, size_t errlen);
+
+#endif /* __TRACE_H_ */